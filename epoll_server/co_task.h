@@ -0,0 +1,48 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+
+#include "frame_allocator.h"
+
+/// 分离执行的协程: 创建后立即运行到第一个挂起点, 结束时自动销毁帧.
+/// 帧由 FrameAllocator 分配; 未捕获的异常被丢弃, 与 Reactor 处理回调异常的方式相同
+class CoTask
+{
+public:
+	struct promise_type
+	{
+		CoTask get_return_object() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void() noexcept
+		{
+		}
+
+		void unhandled_exception() noexcept
+		{
+		}
+
+		static void* operator new(std::size_t size)
+		{
+			return FrameAllocator::allocate(size);
+		}
+
+		static void operator delete(void* p, std::size_t size)
+		{
+			FrameAllocator::deallocate(p, size);
+		}
+	};
+};
@@ -0,0 +1,97 @@
+
+#include "coroutine_acceptor.h"
+#include "observer.h"
+
+#include <stdexcept>
+
+CoroutineAcceptor::AcceptAwaiter::AcceptAwaiter(CoroutineAcceptor& acceptor)
+	: _acceptor(acceptor), _sockfd(-1)
+{
+}
+
+bool CoroutineAcceptor::AcceptAwaiter::await_ready()
+{
+	return _acceptor._shutdown || tryAccept();
+}
+
+void CoroutineAcceptor::AcceptAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	if (_acceptor._pWaiter) throw std::logic_error("acceptor already has a pending accept");
+
+	_handle = handle;
+	_acceptor._pWaiter = this;
+	_acceptor._registration.enableRead();
+}
+
+int CoroutineAcceptor::AcceptAwaiter::await_resume()
+{
+	if (_pError) std::rethrow_exception(_pError);
+	return _sockfd;
+}
+
+bool CoroutineAcceptor::AcceptAwaiter::tryAccept()
+{
+	int sockfd = _acceptor._socket.acceptNonBlocking();
+	if (sockfd < 0) return false;
+
+	// prepareSocket() 失败时关闭新连接
+	ServerSocket socket(sockfd);
+	_acceptor._reactor.prepareSocket(socket);
+	_sockfd = socket.release();
+	return true;
+}
+
+CoroutineAcceptor::CoroutineAcceptor(ServerSocket& socket, SocketReactor& reactor)
+	: _socket(socket), _reactor(reactor), _registration(reactor, socket, 0), _pWaiter(nullptr), _shutdown(false)
+{
+	_socket.setBlocking(false);
+
+	_reactor.addEventHandler(_socket,
+		NObserver<CoroutineAcceptor, ReadableNotification>(*this, &CoroutineAcceptor::onReadable));
+	_reactor.addEventHandler(_socket,
+		NObserver<CoroutineAcceptor, ShutdownNotification>(*this, &CoroutineAcceptor::onShutdown));
+}
+
+CoroutineAcceptor::~CoroutineAcceptor()
+{
+	try
+	{
+		_reactor.removeEventHandler(_socket,
+			NObserver<CoroutineAcceptor, ReadableNotification>(*this, &CoroutineAcceptor::onReadable));
+		_reactor.removeEventHandler(_socket,
+			NObserver<CoroutineAcceptor, ShutdownNotification>(*this, &CoroutineAcceptor::onShutdown));
+	}
+	catch (...)
+	{
+	}
+}
+
+void CoroutineAcceptor::onReadable(const std::shared_ptr<ReadableNotification>& pNf)
+{
+	AcceptAwaiter* pWaiter = _pWaiter;
+	if (!pWaiter) return;
+
+	try
+	{
+		if (!pWaiter->tryAccept()) return;
+	}
+	catch (...)
+	{
+		pWaiter->_pError = std::current_exception();
+	}
+
+	_pWaiter = nullptr;
+	_registration.disableRead();
+	pWaiter->_handle.resume();
+}
+
+void CoroutineAcceptor::onShutdown(const std::shared_ptr<ShutdownNotification>& pNf)
+{
+	_shutdown = true;
+
+	AcceptAwaiter* pWaiter = _pWaiter;
+	if (!pWaiter) return;
+
+	_pWaiter = nullptr;
+	pWaiter->_handle.resume();
+}
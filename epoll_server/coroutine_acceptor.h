@@ -0,0 +1,65 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <boost/noncopyable.hpp>
+
+#include "server_socket.h"
+#include "socket_reactor.h"
+#include "socket_registration.h"
+#include "socket_notification.h"
+
+/// co_await acceptor.accept(): 返回新连接的 fd, 由调用方负责关闭; Reactor 关闭时返回 -1.
+/// 不为连接分配对象, 调用方可以把 socket 直接放在协程帧中.
+/// 与 SocketConnection 一样, 监听 socket 的可读事件只在有协程等待时打开
+class CoroutineAcceptor : public boost::noncopyable
+{
+public:
+	class AcceptAwaiter
+	{
+	public:
+		explicit AcceptAwaiter(CoroutineAcceptor& acceptor);
+
+		bool await_ready();
+
+		void await_suspend(std::coroutine_handle<> handle);
+
+		int await_resume();
+
+	private:
+		bool tryAccept();
+
+		friend class CoroutineAcceptor;
+
+		CoroutineAcceptor& _acceptor;
+		int _sockfd;
+		std::exception_ptr _pError;
+		std::coroutine_handle<> _handle;
+	};
+
+	/// 监听 socket 被设置为非阻塞
+	CoroutineAcceptor(ServerSocket& socket, SocketReactor& reactor);
+	~CoroutineAcceptor();
+
+	AcceptAwaiter accept();
+
+private:
+	void onReadable(const std::shared_ptr<ReadableNotification>& pNf);
+
+	void onShutdown(const std::shared_ptr<ShutdownNotification>& pNf);
+
+	ServerSocket& _socket;
+	SocketReactor& _reactor;
+	SocketRegistration _registration;
+	AcceptAwaiter* _pWaiter;
+	bool _shutdown;
+};
+
+//
+// inlines
+//
+inline CoroutineAcceptor::AcceptAwaiter CoroutineAcceptor::accept()
+{
+	return AcceptAwaiter(*this);
+}
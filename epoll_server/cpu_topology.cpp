@@ -0,0 +1,134 @@
+
+#include "cpu_topology.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace
+{
+	const char* const CPU_ONLINE_PATH = "/sys/devices/system/cpu/online";
+	const char* const NODE_PATH = "/sys/devices/system/node";
+}
+
+CpuTopology::CpuTopology()
+{
+	std::string contents;
+	if (readFile(CPU_ONLINE_PATH, contents)) _online = parseCpuList(contents);
+	if (_online.empty())
+	{
+		long count = sysconf(_SC_NPROCESSORS_ONLN);
+		for (long cpu = 0; cpu < count; ++cpu) _online.push_back((int)cpu);
+	}
+
+	// 节点目录名为 node<N>, 编号不一定连续
+	if (DIR* pDir = opendir(NODE_PATH))
+	{
+		while (struct dirent* pEntry = readdir(pDir))
+		{
+			std::string name(pEntry->d_name);
+			if (name.compare(0, 4, "node") != 0 || name.size() == 4) continue;
+			if (name.find_first_not_of("0123456789", 4) != std::string::npos) continue;
+
+			int node = std::atoi(name.c_str() + 4);
+			if (!readFile(std::string(NODE_PATH) + "/" + name + "/cpulist", contents)) continue;
+			_nodes[node] = parseCpuList(contents);
+		}
+		closedir(pDir);
+	}
+
+	if (_nodes.empty()) _nodes[0] = _online;
+	for (const auto& node : _nodes)
+	{
+		for (int cpu : node.second) _cpuNode[cpu] = node.first;
+	}
+}
+
+const CpuTopology& CpuTopology::instance()
+{
+	static CpuTopology topology;
+	return topology;
+}
+
+std::vector<int> CpuTopology::nodes() const
+{
+	std::vector<int> result;
+	result.reserve(_nodes.size());
+	for (const auto& node : _nodes) result.push_back(node.first);
+	return result;
+}
+
+const std::vector<int>& CpuTopology::cpusOf(int node) const
+{
+	static const std::vector<int> empty;
+	auto it = _nodes.find(node);
+	return it == _nodes.end() ? empty : it->second;
+}
+
+int CpuTopology::nodeOf(int cpu) const
+{
+	auto it = _cpuNode.find(cpu);
+	return it == _cpuNode.end() ? -1 : it->second;
+}
+
+std::vector<int> CpuTopology::parseCpuList(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::istringstream stream(list);
+	std::string range;
+	while (std::getline(stream, range, ','))
+	{
+		// 去掉 sysfs 文件末尾的换行和空白
+		std::size_t begin = range.find_first_not_of(" \t\r\n");
+		if (begin == std::string::npos) continue;
+		range = range.substr(begin, range.find_last_not_of(" \t\r\n") - begin + 1);
+
+		// strtol 会跳过空白并接受符号, 空串解析为 0: 两端都必须以数字开始, 否则 "0-" 也能通过
+		const char* pFirst = range.c_str();
+		char* pEnd = nullptr;
+		long first = std::strtol(pFirst, &pEnd, 10);
+		long last = first;
+		bool valid = std::isdigit((unsigned char)*pFirst);
+		if (valid && *pEnd == '-')
+		{
+			const char* pLast = pEnd + 1;
+			last = std::strtol(pLast, &pEnd, 10);
+			valid = std::isdigit((unsigned char)*pLast);
+		}
+		if (!valid || *pEnd != '\0' || last < first)
+		{
+			throw std::invalid_argument("invalid cpu list: " + list);
+		}
+
+		for (long cpu = first; cpu <= last; ++cpu) cpus.push_back((int)cpu);
+	}
+	return cpus;
+}
+
+bool CpuTopology::setPreferredNode(int node)
+{
+	if (node < 0) return false;
+
+	// 直接使用系统调用, 不依赖 libnuma
+	const unsigned long bits = 8 * sizeof(unsigned long);
+	std::vector<unsigned long> mask(node / bits + 1, 0);
+	mask[node / bits] |= 1ul << (node % bits);
+	return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1) == 0;
+}
+
+bool CpuTopology::readFile(const std::string& path, std::string& contents)
+{
+	std::ifstream file(path);
+	if (!file) return false;
+
+	std::ostringstream buffer;
+	buffer << file.rdbuf();
+	contents = buffer.str();
+	return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+/// 从 /sys/devices/system 读取的 CPU 与 NUMA 节点拓扑. 没有 NUMA 信息 (内核未开启或容器中不可见) 时
+/// 所有在线 CPU 视为属于节点 0
+class CpuTopology : public boost::noncopyable
+{
+public:
+	CpuTopology();
+
+	/// 进程启动后第一次调用时读取, 之后不再变化
+	static const CpuTopology& instance();
+
+	const std::vector<int>& onlineCpus() const;
+
+	std::vector<int> nodes() const;
+
+	/// 节点不存在时返回空集合
+	const std::vector<int>& cpusOf(int node) const;
+
+	/// CPU 所在的节点, 未知的 CPU 返回 -1
+	int nodeOf(int cpu) const;
+
+	/// 解析 "0-3,8,10-11" 形式的 CPU 列表, 格式错误时抛出 std::invalid_argument
+	static std::vector<int> parseCpuList(const std::string& list);
+
+	/// 调用线程之后的内存页优先从 node 分配 (set_mempolicy MPOL_PREFERRED), 失败时返回 false
+	static bool setPreferredNode(int node);
+
+private:
+	static bool readFile(const std::string& path, std::string& contents);
+
+	std::vector<int> _online;
+	std::map<int, std::vector<int>> _nodes;
+	std::map<int, int> _cpuNode;
+};
+
+//
+// inlines
+//
+inline const std::vector<int>& CpuTopology::onlineCpus() const
+{
+	return _online;
+}
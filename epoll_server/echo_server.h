@@ -4,30 +4,63 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <map>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <algorithm>
 
 #include "server_socket.h"
 #include "socket_reactor.h"
+#include "socket_proactor.h"
 #include "socket_acceptor.h"
+#include "socket_reactor_pool.h"
+#include "parallel_socket_acceptor.h"
+#include "sharded_socket_acceptor.h"
 #include "server_application.h"
 #include "fifo_buffer.h"
 #include "observer.h"
 #include "socket_notification.h"
+#include "socket_connection.h"
+#include "coroutine_acceptor.h"
+#include "co_task.h"
 
 #define SERVER_PORT   8080
 
-class EchoServiceHandler
+/// 对象和两个 FIFO 缓冲区都从 Reactor 的 slab 中分配
+class EchoServiceHandler : public SlabAllocated
 {
 public:
 	EchoServiceHandler(ServerSocket& socket, SocketReactor& reactor)
-		: _socket(socket), _reactor(reactor), _fifoIn(BUFFER_SIZE, true), _fifoOut(BUFFER_SIZE, true)
+		: _socket(socket), _reactor(reactor),
+		  _inStorage(reactor.allocator(), BUFFER_SIZE), _outStorage(reactor.allocator(), BUFFER_SIZE),
+		  _fifoIn(_inStorage.as<char>(), BUFFER_SIZE, true), _fifoOut(_outStorage.as<char>(), BUFFER_SIZE, true),
+		  _registration(reactor, socket, PollSet::POLL_READ | (reactor.isEdgeTriggered() ? PollSet::POLL_WRITE : 0)),
+		  _edgeTriggered(reactor.isEdgeTriggered())
 	{
+		// 读超时只能在 Reactor 线程中派发, 处理器在其它线程上运行时不设置
+		_deadlines = reactor.getWorkerThreads() == 0 && reactor.getLeaderFollowerThreads() <= 1;
+
+		// 观察者只注册一次, 之后由 _registration 开关读写事件
+		if (_edgeTriggered) _socket.setBlocking(false);
 		_reactor.addEventHandler(_socket,
 			NObserver<EchoServiceHandler, ReadableNotification>(*this, &EchoServiceHandler::onSocketReadable));
+		_reactor.addEventHandler(_socket,
+			NObserver<EchoServiceHandler, WritableNotification>(*this, &EchoServiceHandler::onSocketWritable));
 		_reactor.addEventHandler(_socket,
 			NObserver<EchoServiceHandler, ShutdownNotification>(*this, &EchoServiceHandler::onSocketShutdown));
 
+		// 空闲超时由 Reactor 在每次可读时顺延
+		if (_deadlines)
+		{
+			_reactor.addEventHandler(_socket,
+				NObserver<EchoServiceHandler, ReadTimeoutNotification>(*this, &EchoServiceHandler::onSocketReadTimeout));
+			_reactor.setReadTimeout(_socket, std::chrono::seconds(IDLE_TIMEOUT));
+		}
+
+		// 边缘触发: 读写事件一直打开, 不随缓冲区状态开关
+		if (_edgeTriggered) return;
+
 		_connIn = _fifoIn.writable.connect([this](bool b)
 		{ onFIFOInWritable(b); });
 		_connOut = _fifoOut.readable.connect([this](bool b)
@@ -36,6 +69,26 @@ public:
 
 	~EchoServiceHandler()
 	{
+		if (!_closed.exchange(true)) unregister();
+	}
+
+	/// 注销事件之后交给 Reactor 延迟销毁: 当前通知的回调以及其它派发线程可能还在使用本对象
+	void close()
+	{
+		if (_closed.exchange(true)) return;
+
+		unregister();
+		_reactor.retire(this);
+	}
+
+private:
+	void unregister()
+	{
+		if (_deadlines)
+		{
+			_reactor.removeEventHandler(_socket,
+				NObserver<EchoServiceHandler, ReadTimeoutNotification>(*this, &EchoServiceHandler::onSocketReadTimeout));
+		}
 		_reactor.removeEventHandler(_socket,
 			NObserver<EchoServiceHandler, ReadableNotification>(*this, &EchoServiceHandler::onSocketReadable));
 		_reactor.removeEventHandler(_socket,
@@ -51,40 +104,43 @@ public:
 	void onFIFOOutReadable(bool& b)
 	{
 		if (b)
-			_reactor.addEventHandler(_socket,
-				NObserver<EchoServiceHandler, WritableNotification>(*this, &EchoServiceHandler::onSocketWritable));
+			_registration.enableWrite();
 		else
-			_reactor.removeEventHandler(_socket,
-				NObserver<EchoServiceHandler, WritableNotification>(*this, &EchoServiceHandler::onSocketWritable));
+			_registration.disableWrite();
 	}
 
 	void onFIFOInWritable(bool& b)
 	{
 		if (b)
-			_reactor.addEventHandler(_socket,
-				NObserver<EchoServiceHandler, ReadableNotification>(*this, &EchoServiceHandler::onSocketReadable));
+			_registration.enableRead();
 		else
-			_reactor.removeEventHandler(_socket,
-				NObserver<EchoServiceHandler, ReadableNotification>(*this, &EchoServiceHandler::onSocketReadable));
+			_registration.disableRead();
 	}
 
 	void onSocketReadable(const std::shared_ptr<ReadableNotification>& pNf)
 	{
 		try
 		{
+			if (_edgeTriggered)
+			{
+				if (!pump()) close();
+				return;
+			}
+
 			ssize_t len = _socket.receiveBytes(_fifoIn);
+			// 新连接是非阻塞的, 虚假唤醒时返回 -1
 			if (len > 0)
 			{
-				_fifoIn.drain(_fifoOut.write(_fifoIn.buffer(), _fifoIn.used()));
+				forward();
 			}
-			else
+			else if (len == 0)
 			{
-				delete this;
+				close();
 			}
 		}
 		catch (const std::exception& exc)
 		{
-			delete this;
+			close();
 		}
 	}
 
@@ -92,35 +148,173 @@ public:
 	{
 		try
 		{
+			if (_edgeTriggered)
+			{
+				if (!pump()) close();
+				return;
+			}
+
+			// 非阻塞 socket 可能只写出一部分, 输入缓冲区里剩下的数据要在腾出空间后搬过去
 			_socket.sendBytes(_fifoOut);
+			forward();
 		}
 		catch (const std::exception& exc)
 		{
-			delete this;
+			close();
 		}
 	}
 
 	void onSocketShutdown(const std::shared_ptr<ShutdownNotification>& pNf)
 	{
-		delete this;
+		close();
+	}
+
+	void onSocketReadTimeout(const std::shared_ptr<ReadTimeoutNotification>& pNf)
+	{
+		close();
 	}
 
 private:
+	/// 输入缓冲区的数据尽量搬到输出缓冲区. drain(0) 会清空整个缓冲区, 输出满时不能调用
+	void forward()
+	{
+		std::size_t length = _fifoOut.write(_fifoIn.begin(), _fifoIn.used());
+		if (length > 0) _fifoIn.drain(length);
+	}
+
+	/// 边缘触发: 读到 EAGAIN 并回写; 输出阻塞时停止读取, 等下一次 EPOLLOUT 边缘再继续.
+	/// 超出 Reactor 的派发预算时让出, 剩下的数据下一轮再读. 对端关闭时返回 false
+	bool pump()
+	{
+		// 上一轮排队的输出还没有发完: Reactor 在 socket 可写时先发出积压的数据, 再通知本处理器
+		if (_reactor.queued(_socket) > 0) return true;
+
+		std::size_t budget = _reactor.getDispatchBudget();
+		std::size_t received = 0;
+		for (;;)
+		{
+			bool inDrained = false;
+			bool outDrained = true;
+			if (!_fifoIn.isFull())
+			{
+				ssize_t len = _socket.receiveAll(_fifoIn, inDrained);
+				if (len == 0) return false;
+				if (len > 0) received += len;
+			}
+			forward();
+			if (!_fifoOut.isEmpty()) outDrained = send();
+
+			if (inDrained || !outDrained) return true;
+			if (budget > 0 && received >= budget && _reactor.yield(_socket, PollSet::POLL_READ)) return true;
+		}
+	}
+
+	/// 输出交给 Reactor 排队, 本轮结束时与之前的回显一起发出; 排队太多时让出, 下一轮再继续读.
+	/// Reactor 不能排队时直接写到 EAGAIN 为止. 返回 false 表示需要等待
+	bool send()
+	{
+		std::size_t length = _fifoOut.used();
+		if (!_reactor.send(_socket, _fifoOut.begin(), length))
+		{
+			bool drained = false;
+			_socket.sendAll(_fifoOut, drained);
+			return drained;
+		}
+
+		_fifoOut.drain(length);
+		return _reactor.queued(_socket) < MAX_QUEUED || !_reactor.yield(_socket, PollSet::POLL_READ);
+	}
+
 	enum
 	{
-		BUFFER_SIZE = 1024
+		BUFFER_SIZE = 1024,
+		MAX_QUEUED = 64 * 1024,
+		IDLE_TIMEOUT = 30
 	};
 
 	ServerSocket _socket;
 	SocketReactor& _reactor;
 
+	SlabBlock _inStorage;
+	SlabBlock _outStorage;
 	FIFOBuffer _fifoIn;
 	FIFOBuffer _fifoOut;
 
+	SocketRegistration _registration;
+
+	bool _edgeTriggered;
+	bool _deadlines;
+	std::atomic<bool> _closed{ false };
+
 	boost::signals2::connection _connOut;
 	boost::signals2::connection _connIn;
 };
 
+/// Proactor 方式的回显: 数据在共享的 buffer ring 中收到, 复制进发送队列后立即归还
+class EchoCompletionHandler : public boost::noncopyable
+{
+public:
+	/// 以 fd 为键, 只在 Proactor 线程中访问; 清空时取消所有连接上的操作并关闭它们
+	typedef std::map<int, std::unique_ptr<EchoCompletionHandler>> Map;
+
+	EchoCompletionHandler(int sockfd, SocketProactor& proactor, Map& handlers)
+		: _socket(sockfd), _proactor(proactor), _handlers(handlers)
+	{
+		_proactor.receive(_socket, [this](SocketProactor::Buffer data, int error)
+		{ onReceive(data, error); });
+	}
+
+	~EchoCompletionHandler()
+	{
+		// 取消未完成的操作之后即可关闭 socket
+		_proactor.cancel(_socket);
+	}
+
+private:
+	void onReceive(SocketProactor::Buffer data, int error)
+	{
+		if (!data.empty())
+		{
+			_proactor.send(_socket, data.data(), data.size());
+			return;
+		}
+
+		// 对端关闭或出错
+		_handlers.erase(_socket.sockfd());
+	}
+
+	ServerSocket _socket;
+	SocketProactor& _proactor;
+	Map& _handlers;
+};
+
+/// 协程方式的回显: 读到多少写回多少, 对端关闭或 Reactor 关闭时结束
+/// 连接和缓冲区都在协程帧中, 每个连接只分配一次帧
+inline CoTask echoConnection(int sockfd, SocketReactor& reactor)
+{
+	enum
+	{
+		BUFFER_SIZE = 1024
+	};
+
+	SocketConnection connection(sockfd, reactor);
+	char buffer[BUFFER_SIZE];
+	FIFOBuffer fifo(buffer, BUFFER_SIZE);
+	while (co_await connection.read(fifo) > 0)
+	{
+		co_await connection.writeAll(fifo);
+	}
+}
+
+inline CoTask acceptConnections(CoroutineAcceptor& acceptor, SocketReactor& reactor)
+{
+	int sockfd;
+	while ((sockfd = co_await acceptor.accept()) >= 0)
+	{
+		echoConnection(sockfd, reactor);
+	}
+}
+
 class EchoServer : public ServerApplication
 {
 public:
@@ -142,9 +336,80 @@ protected:
 	{
 		unsigned short port = SERVER_PORT;
 
-		ServerSocket svs(port);
+		_edgeTriggered = hasOption(args, "--edge-triggered");
+		_busyPoll = hasOption(args, "--busy-poll");
+		_numaLocal = hasOption(args, "--numa");
+		_realtime = hasOption(args, "--realtime");
+		_fair = hasOption(args, "--fair");
+		if (hasOption(args, "--io-uring"))
+		{
+			PollSet::setDefaultBackend(PollSet::BACKEND_URING);
+		}
+
+		// 不加锁的构建中每个 Reactor 只能在自己的线程中使用: 多个线程共用一个 Reactor 的模式直接拒绝
+		if (!SocketReactor::ThreadingPolicy::THREAD_SAFE &&
+			(hasOption(args, "--workers") || hasOption(args, "--leader-followers")))
+		{
+			return ServerApplication::EXIT_USAGE;
+		}
+
+		if (hasOption(args, "--workers"))
+		{
+			return runSingleReactor(port, std::thread::hardware_concurrency(), 1);
+		}
+		if (hasOption(args, "--leader-followers"))
+		{
+			return runSingleReactor(port, 0, std::thread::hardware_concurrency());
+		}
+
+		if (hasOption(args, "--proactor"))
+		{
+			return runProactor(port);
+		}
+		if (hasOption(args, "--coroutines"))
+		{
+			return runCoroutines(port);
+		}
+
+		if (hasOption(args, "--reuseport"))
+		{
+			return runSharded(port, hasOption(args, "--cpu-steering"));
+		}
+
+		ServerSocket svs;
+		svs.bind(port, true);
+		if (!svs.listen()) ServerSocket::error(port);
 
 		SocketReactor reactor;
+		SocketReactorPool pool;
+		configure(pool);
+
+		ParallelSocketAcceptor<EchoServiceHandler> acceptor(svs, reactor, pool);
+
+		pool.start();
+		std::thread thread([&reactor]()
+		{ reactor.run(); });
+
+		waitForTerminationRequest();
+
+		reactor.stop();
+		thread.join();
+		pool.stop();
+
+		return ServerApplication::EXIT_OK;
+	}
+
+	/// 单 Reactor 多线程: 由工作线程池处理就绪的 socket, 或者多个线程以 leader/followers 方式共用一个 Reactor
+	int runSingleReactor(unsigned short port, std::size_t workers, std::size_t leaders)
+	{
+		ServerSocket svs;
+		svs.bind(port, true);
+		if (!svs.listen()) ServerSocket::error(port);
+
+		SocketReactor reactor;
+		reactor.setEdgeTriggered(_edgeTriggered);
+		reactor.setWorkerThreads(workers);
+		reactor.setLeaderFollowerThreads(leaders);
 
 		SocketAcceptor<EchoServiceHandler> acceptor(svs, reactor);
 
@@ -158,4 +423,116 @@ protected:
 
 		return ServerApplication::EXIT_OK;
 	}
+
+	/// 每个 Reactor 线程一个 SO_REUSEPORT 监听 socket
+	int runSharded(unsigned short port, bool steerByCpu)
+	{
+		SocketReactorPool pool;
+		pool.setThreadAffinity(steerByCpu);
+		configure(pool);
+
+		ShardedSocketAcceptor<EchoServiceHandler> acceptor(port, pool, steerByCpu);
+
+		pool.start();
+
+		waitForTerminationRequest();
+
+		pool.stop();
+
+		return ServerApplication::EXIT_OK;
+	}
+
+	/// 单线程 Proactor, 内核不支持时退出
+	int runProactor(unsigned short port)
+	{
+		if (!SocketProactor::supported()) return ServerApplication::EXIT_UNAVAILABLE;
+
+		ServerSocket svs;
+		svs.bind(port, true);
+		if (!svs.listen()) ServerSocket::error(port);
+
+		SocketProactor proactor;
+		EchoCompletionHandler::Map handlers;
+		proactor.accept(svs, [&proactor, &handlers](int sockfd)
+		{
+			if (sockfd >= 0) handlers[sockfd] = std::make_unique<EchoCompletionHandler>(sockfd, proactor, handlers);
+		});
+
+		// 循环结束后仍在 Proactor 线程中释放剩下的连接, 之后才能销毁 Proactor
+		std::thread thread([&proactor, &handlers]()
+		{
+			proactor.run();
+			handlers.clear();
+		});
+
+		waitForTerminationRequest();
+
+		proactor.stop();
+		thread.join();
+
+		return ServerApplication::EXIT_OK;
+	}
+
+	/// 单线程 Reactor 上的协程
+	int runCoroutines(unsigned short port)
+	{
+		ServerSocket svs;
+		svs.bind(port, true);
+		if (!svs.listen()) ServerSocket::error(port);
+
+		SocketReactor reactor;
+		CoroutineAcceptor acceptor(svs, reactor);
+		acceptConnections(acceptor, reactor);
+
+		std::thread thread([&reactor]()
+		{ reactor.run(); });
+
+		waitForTerminationRequest();
+
+		reactor.stop();
+		thread.join();
+
+		return ServerApplication::EXIT_OK;
+	}
+
+private:
+	void configure(SocketReactorPool& pool)
+	{
+		// 线程的放置在第一次访问 Reactor (创建它们) 之前设置
+		if (_numaLocal)
+		{
+			pool.setThreadAffinity(true);
+			pool.setNumaLocal(true);
+		}
+		if (_realtime) pool.setRealtimePriority(REALTIME_PRIORITY);
+
+		for (std::size_t i = 0; i < pool.size(); ++i)
+		{
+			pool.reactor(i).setEdgeTriggered(_edgeTriggered);
+			if (_fair) pool.reactor(i).setDispatchBudget(DISPATCH_BUDGET);
+		}
+		if (_busyPoll)
+		{
+			pool.setBusyPoll(std::chrono::microseconds(BUSY_POLL_USECS));
+			pool.setSocketBusyPoll(BUSY_POLL_USECS, true);
+		}
+	}
+
+	static bool hasOption(const std::vector<std::string>& args, const std::string& option)
+	{
+		return std::find(args.begin(), args.end(), option) != args.end();
+	}
+
+	enum
+	{
+		BUSY_POLL_USECS = 50,
+		REALTIME_PRIORITY = 10,
+		DISPATCH_BUDGET = 16 * 1024
+	};
+
+	bool _edgeTriggered = false;
+	bool _busyPoll = false;
+	bool _numaLocal = false;
+	bool _realtime = false;
+	bool _fair = false;
 };
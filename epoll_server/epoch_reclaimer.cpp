@@ -0,0 +1,102 @@
+
+#include "epoch_reclaimer.h"
+
+#include <algorithm>
+
+EpochReclaimer::Guard::Guard(EpochReclaimer& reclaimer, Record* pRecord)
+	: _pRecord(pRecord)
+{
+	// 先公开自己所在的 epoch 再访问共享对象, seq_cst 保证推进 epoch 的线程能看到
+	_pRecord->epoch.store(reclaimer._epoch.load());
+	_pRecord->active.store(true);
+}
+
+EpochReclaimer::Guard::~Guard()
+{
+	_pRecord->active.store(false, std::memory_order_release);
+}
+
+EpochReclaimer::EpochReclaimer()
+	: _epoch(0), _pending(0)
+{
+}
+
+EpochReclaimer::~EpochReclaimer()
+{
+	for (auto& retired : _limbo)
+	{
+		retired.deleter(retired.pObject);
+	}
+}
+
+EpochReclaimer::Record* EpochReclaimer::attach()
+{
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	for (auto& pRecord : _records)
+	{
+		if (!pRecord->inUse)
+		{
+			pRecord->inUse = true;
+			return pRecord.get();
+		}
+	}
+	_records.push_back(std::make_unique<Record>());
+	_records.back()->inUse = true;
+	return _records.back().get();
+}
+
+void EpochReclaimer::detach(Record* pRecord)
+{
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	pRecord->active.store(false, std::memory_order_release);
+	pRecord->inUse = false;
+}
+
+void EpochReclaimer::retire(void* pObject, void (* deleter)(void*))
+{
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	_limbo.push_back({ pObject, deleter, _epoch.load() });
+	_pending.store(_limbo.size(), std::memory_order_relaxed);
+}
+
+void EpochReclaimer::reclaim()
+{
+	if (_pending.load(std::memory_order_relaxed) == 0) return;
+
+	// 每次最多推进一个 epoch, 两次推进之后在此之前 retire 的对象都不再可见
+	tryAdvance();
+	tryAdvance();
+
+	std::vector<Retired> ready;
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+
+		uint64_t epoch = _epoch.load();
+		auto it = std::stable_partition(_limbo.begin(), _limbo.end(), [epoch](const Retired& retired)
+		{ return retired.epoch + 2 > epoch; });
+		ready.assign(it, _limbo.end());
+		_limbo.erase(it, _limbo.end());
+		_pending.store(_limbo.size(), std::memory_order_relaxed);
+	}
+
+	// 析构函数中可能再次 retire, 不能持有 _mutex
+	for (auto& retired : ready)
+	{
+		retired.deleter(retired.pObject);
+	}
+}
+
+bool EpochReclaimer::tryAdvance()
+{
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	uint64_t epoch = _epoch.load();
+	for (auto& pRecord : _records)
+	{
+		if (pRecord->active.load() && pRecord->epoch.load() != epoch) return false;
+	}
+	return _epoch.compare_exchange_strong(epoch, epoch + 1);
+}
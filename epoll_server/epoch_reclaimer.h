@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+/// 基于 epoch 的延迟回收.
+/// 派发线程在访问处理器期间持有 Guard; retire() 的对象记录当时的全局 epoch,
+/// 只有当所有持有 Guard 的线程都已经观察到之后的两个 epoch, 才真正 delete.
+/// 没有其它派发线程时 reclaim() 立即释放所有对象, 即单线程 Reactor 在本轮循环结束时回收.
+class EpochReclaimer : public boost::noncopyable
+{
+public:
+	/// 每个派发线程一个, 由 attach() 分配
+	struct alignas(64) Record
+	{
+		std::atomic<uint64_t> epoch{ 0 };
+		std::atomic<bool> active{ false };
+		bool inUse = false;
+	};
+
+	class Guard : public boost::noncopyable
+	{
+	public:
+		Guard(EpochReclaimer& reclaimer, Record* pRecord);
+		~Guard();
+
+	private:
+		Record* _pRecord;
+	};
+
+	EpochReclaimer();
+	~EpochReclaimer();
+
+	Record* attach();
+
+	void detach(Record* pRecord);
+
+	template<class T>
+	void retire(T* pObject);
+
+	/// 尝试推进 epoch 并释放已经安全的对象, 调用线程自己不能持有 Guard
+	void reclaim();
+
+	std::size_t pending() const;
+
+private:
+	struct Retired
+	{
+		void* pObject;
+		void (* deleter)(void*);
+		uint64_t epoch;
+	};
+
+	void retire(void* pObject, void (* deleter)(void*));
+
+	bool tryAdvance();
+
+	std::atomic<uint64_t> _epoch;
+	std::vector<std::unique_ptr<Record>> _records;
+	std::vector<Retired> _limbo;
+	std::atomic<std::size_t> _pending;
+	mutable std::mutex _mutex;
+};
+
+//
+// inlines
+//
+template<class T>
+inline void EpochReclaimer::retire(T* pObject)
+{
+	retire(static_cast<void*>(pObject), [](void* p)
+	{ delete static_cast<T*>(p); });
+}
+
+inline std::size_t EpochReclaimer::pending() const
+{
+	return _pending.load(std::memory_order_relaxed);
+}
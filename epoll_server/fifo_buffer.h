@@ -7,8 +7,11 @@
 #include <boost/signals2.hpp>
 
 #include "buffer.h"
+#include "threading.h"
 
-template<class T>
+/// Mutex 默认为递归锁: ServerSocket 在持有缓冲区锁的同时调用 advance()/drain(), 信号回调中也可能再次访问缓冲区.
+/// 只在一个线程中使用的缓冲区可以用 NullMutex
+template<class T, class Mutex = std::recursive_mutex>
 class BasicFIFOBuffer
 {
 public:
@@ -40,7 +43,7 @@ public:
 
 	void resize(std::size_t newSize, bool preserveContent = true)
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 
 		if (preserveContent && (newSize < _used))
 			throw std::runtime_error("Can not resize FIFO without data loss.");
@@ -54,7 +57,7 @@ public:
 	std::size_t peek(T* pBuffer, std::size_t length) const
 	{
 		if (0 == length) return 0;
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		if (!isReadable()) return 0;
 		if (length > _used) length = _used;
 		std::memcpy(pBuffer, _buffer.begin() + _begin, length * sizeof(T));
@@ -63,7 +66,7 @@ public:
 
 	std::size_t peek(Buffer<T>& buffer, std::size_t length = 0) const
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		if (!isReadable()) return 0;
 		if (0 == length || length > _used) length = _used;
 		buffer.resize(length);
@@ -73,7 +76,7 @@ public:
 	std::size_t read(T* pBuffer, std::size_t length)
 	{
 		if (0 == length) return 0;
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		if (!isReadable()) return 0;
 		std::size_t usedBefore = _used;
 		std::size_t readLen = peek(pBuffer, length);
@@ -89,7 +92,7 @@ public:
 
 	std::size_t read(Buffer<T>& buffer, std::size_t length = 0)
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		if (!isReadable()) return 0;
 		std::size_t usedBefore = _used;
 		std::size_t readLen = peek(buffer, length);
@@ -107,7 +110,7 @@ public:
 	{
 		if (0 == length) return 0;
 
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 
 		if (!isWritable()) return 0;
 
@@ -153,7 +156,7 @@ public:
 
 	void drain(std::size_t length = 0)
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 
 		std::size_t usedBefore = _used;
 
@@ -176,7 +179,7 @@ public:
 		poco_check_ptr(ptr);
 		if (0 == length) return;
 
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 
 		if (length > available())
 		{
@@ -196,7 +199,7 @@ public:
 
 	void advance(std::size_t length)
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 
 		if (length > available())
 		{
@@ -221,7 +224,7 @@ public:
 
 	T* begin()
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		if (_begin != 0)
 		{
 			std::memmove(_buffer.begin(), _buffer.begin() + _begin, _used * sizeof(T));
@@ -232,13 +235,13 @@ public:
 
 	T* next()
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		return begin() + _used;
 	}
 
 	T& operator[](std::size_t index)
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		if (index >= _used)
 		{
 			throw std::runtime_error((boost::format("Index out of bounds: %z (max index allowed: %z)") % index, _used
@@ -250,7 +253,7 @@ public:
 
 	const T& operator[](std::size_t index) const
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		if (index >= _used)
 		{
 			throw std::runtime_error((boost::format("Index out of bounds: %z (max index allowed: %z)") % index, _used
@@ -270,7 +273,7 @@ public:
 		if (error)
 		{
 			bool f = false;
-			std::unique_lock<std::mutex> lock(_mutex);
+			std::unique_lock<Mutex> lock(_mutex);
 			if (isReadable() && _notify) readable(f);
 			if (isWritable() && _notify) writable(f);
 			_error = error;
@@ -279,7 +282,7 @@ public:
 		else
 		{
 			bool t = true;
-			std::unique_lock<std::mutex> lock(_mutex);
+			std::unique_lock<Mutex> lock(_mutex);
 			_error = false;
 			if (_notify && !_eof) writable(t);
 		}
@@ -292,7 +295,7 @@ public:
 
 	void setEOF(bool eof = true)
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		std::unique_lock<Mutex> lock(_mutex);
 		bool flag = !eof;
 		if (_notify) writable(flag);
 		_eof = eof;
@@ -338,7 +341,7 @@ public:
 		return _notify;
 	}
 
-	std::mutex& mutex()
+	Mutex& mutex()
 	{
 		return _mutex;
 	}
@@ -373,11 +376,12 @@ private:
 	std::size_t _begin;
 	std::size_t _used;
 
-	mutable std::mutex _mutex;
+	mutable Mutex _mutex;
 
 	bool _notify;
 	bool _eof;
 	bool _error;
 };
 
-typedef BasicFIFOBuffer<char> FIFOBuffer;
+typedef BasicFIFOBuffer<char, DefaultThreadingPolicy::RecursiveMutex> FIFOBuffer;
+typedef BasicFIFOBuffer<char, NullMutex> UnsynchronizedFIFOBuffer;
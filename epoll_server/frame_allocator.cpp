@@ -0,0 +1,85 @@
+
+#include "frame_allocator.h"
+
+#include <new>
+
+namespace
+{
+	struct FreeFrame
+	{
+		FreeFrame* pNext;
+	};
+
+	struct FrameCache
+	{
+		FreeFrame* heads[FrameAllocator::CLASS_COUNT] = {};
+		std::size_t counts[FrameAllocator::CLASS_COUNT] = {};
+
+		~FrameCache()
+		{
+			for (auto pHead : heads)
+			{
+				while (pHead)
+				{
+					FreeFrame* pNext = pHead->pNext;
+					::operator delete(pHead);
+					pHead = pNext;
+				}
+			}
+		}
+	};
+
+	thread_local FrameCache frameCache;
+
+	std::size_t sizeClass(std::size_t size)
+	{
+		return (size + FrameAllocator::GRANULARITY - 1) / FrameAllocator::GRANULARITY - 1;
+	}
+}
+
+void* FrameAllocator::allocate(std::size_t size)
+{
+	if (size == 0 || size > MAX_SIZE) return ::operator new(size);
+
+	std::size_t index = sizeClass(size);
+	FreeFrame* pFrame = frameCache.heads[index];
+	if (pFrame)
+	{
+		frameCache.heads[index] = pFrame->pNext;
+		--frameCache.counts[index];
+		return pFrame;
+	}
+	return ::operator new((index + 1) * GRANULARITY);
+}
+
+void FrameAllocator::deallocate(void* p, std::size_t size)
+{
+	if (size == 0 || size > MAX_SIZE)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	// 帧可能在另一个线程中结束, 放入当前线程的缓存即可: 内存来自同一个全局堆
+	std::size_t index = sizeClass(size);
+	if (frameCache.counts[index] >= MAX_CACHED_PER_CLASS)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	auto pFrame = static_cast<FreeFrame*>(p);
+	pFrame->pNext = frameCache.heads[index];
+	frameCache.heads[index] = pFrame;
+	++frameCache.counts[index];
+}
+
+std::size_t FrameAllocator::cached()
+{
+	std::size_t count = 0;
+	for (auto n : frameCache.counts)
+	{
+		count += n;
+	}
+	return count;
+}
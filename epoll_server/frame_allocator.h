@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+/// 协程帧分配器: 按 64 字节分级的线程本地空闲链表.
+/// 帧释放后留给同一线程之后创建的协程复用, 稳定状态下不再调用全局 operator new.
+/// 大于 MAX_SIZE 的帧直接使用 operator new
+class FrameAllocator
+{
+public:
+	static void* allocate(std::size_t size);
+
+	static void deallocate(void* p, std::size_t size);
+
+	/// 当前线程缓存的空闲帧数量
+	static std::size_t cached();
+
+	enum
+	{
+		GRANULARITY = 64,
+		CLASS_COUNT = 32,
+		MAX_SIZE = GRANULARITY * CLASS_COUNT,
+		MAX_CACHED_PER_CLASS = 4096
+	};
+};
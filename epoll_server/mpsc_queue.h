@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <boost/noncopyable.hpp>
+
+/// 无锁多生产者单消费者队列 (Vyukov).
+/// push()/pushBatch() 可以在任意线程调用, pop() 只能由一个消费者线程调用.
+/// 消费者取走的节点挂到空闲栈上供生产者复用, 稳定状态下入队出队都不分配内存;
+/// 节点在队列析构之前不归还, 空闲栈的长度不超过队列曾经达到的最大长度
+template<class T>
+class MPSCQueue : public boost::noncopyable
+{
+	struct Node
+	{
+		Node() = default;
+
+		explicit Node(T&& v)
+			: value(std::move(v))
+		{
+		}
+
+		/// 在队列中指向后一个节点, 在空闲栈中指向下一个空闲节点
+		std::atomic<Node*> next{ nullptr };
+		T value;
+	};
+
+public:
+	MPSCQueue()
+		: _head(new Node), _tail(_head.load(std::memory_order_relaxed)), _free(0)
+	{
+	}
+
+	~MPSCQueue()
+	{
+		T value;
+		while (pop(value))
+		{
+		}
+		delete _tail;
+
+		Node* pNode = pointer(_free.load(std::memory_order_relaxed));
+		while (pNode)
+		{
+			Node* pNext = pNode->next.load(std::memory_order_relaxed);
+			delete pNode;
+			pNode = pNext;
+		}
+	}
+
+	void push(T value)
+	{
+		Node* pNode = acquire(std::move(value));
+		link(pNode, pNode);
+	}
+
+	/// 整批入队只需要一次原子交换, 消费者看到的顺序与迭代顺序相同
+	template<class Iterator>
+	void pushBatch(Iterator first, Iterator last)
+	{
+		if (first == last) return;
+
+		Node* pFirst = acquire(std::move(*first));
+		Node* pLast = pFirst;
+		for (++first; first != last; ++first)
+		{
+			Node* pNode = acquire(std::move(*first));
+			pLast->next.store(pNode, std::memory_order_relaxed);
+			pLast = pNode;
+		}
+		link(pFirst, pLast);
+	}
+
+	bool pop(T& value)
+	{
+		Node* pTail = _tail;
+		Node* pNext = pTail->next.load(std::memory_order_acquire);
+		if (!pNext) return false;
+
+		value = std::move(pNext->value);
+		_tail = pNext;
+		recycle(pTail);
+		return true;
+	}
+
+	/// 生产者已经入队但尚未链接完成的节点也视为非空
+	bool empty() const
+	{
+		return _head.load(std::memory_order_seq_cst) == _tail;
+	}
+
+private:
+	void link(Node* pFirst, Node* pLast)
+	{
+		Node* pPrev = _head.exchange(pLast, std::memory_order_seq_cst);
+		pPrev->next.store(pFirst, std::memory_order_release);
+	}
+
+	Node* acquire(T&& value)
+	{
+		uint64_t top = _free.load(std::memory_order_acquire);
+		while (Node* pNode = pointer(top))
+		{
+			// 读到的 next 可能已经过时 (节点被其它生产者取走), 这时 tag 变了, CAS 失败重试.
+			// 节点在队列析构之前不释放, 读它不会越界
+			Node* pNext = pNode->next.load(std::memory_order_relaxed);
+			if (_free.compare_exchange_weak(top, tagged(pNext, top), std::memory_order_acquire, std::memory_order_acquire))
+			{
+				pNode->next.store(nullptr, std::memory_order_relaxed);
+				pNode->value = std::move(value);
+				return pNode;
+			}
+		}
+		return new Node(std::move(value));
+	}
+
+	/// 只在消费者线程调用
+	void recycle(Node* pNode)
+	{
+		// 释放移出之后残留的资源, 例如 std::function 捕获的对象
+		pNode->value = T();
+
+		uint64_t top = _free.load(std::memory_order_relaxed);
+		do
+		{
+			pNode->next.store(pointer(top), std::memory_order_relaxed);
+		} while (!_free.compare_exchange_weak(top, tagged(pNode, top), std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	/// 空闲栈顶: 低 48 位是指针, 高 16 位是每次修改递增的 tag, 防止 ABA
+	static Node* pointer(uint64_t top)
+	{
+		return reinterpret_cast<Node*>(top & POINTER_MASK);
+	}
+
+	static uint64_t tagged(Node* pNode, uint64_t top)
+	{
+		return ((top & ~POINTER_MASK) + (POINTER_MASK + 1)) | reinterpret_cast<uint64_t>(pNode);
+	}
+
+	static constexpr uint64_t POINTER_MASK = (uint64_t(1) << 48) - 1;
+
+	static_assert(sizeof(void*) == sizeof(uint64_t), "tagged free list requires 64-bit pointers");
+
+	std::atomic<Node*> _head;
+	Node* _tail;
+	std::atomic<uint64_t> _free;
+};
@@ -1,5 +1,10 @@
 #include "notification.h"
 
+Notification::Notification(int id)
+	: _id(id)
+{
+}
+
 std::string Notification::name() const
 {
 	return typeid(*this).name();
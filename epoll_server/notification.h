@@ -8,8 +8,28 @@ class Notification
 public:
 	using Ptr = std::unique_ptr<Notification>;
 
+	enum
+	{
+		UNKNOWN_ID = -1
+	};
+
 	Notification() = default;
+	/// 有编译期 ID 的通知 (定义了 static constexpr int ID 的类型) 由观察者按 ID 匹配, 不需要 RTTI
+	explicit Notification(int id);
 	virtual ~Notification() = default;
 
 	virtual std::string name() const;
+
+	int id() const;
+
+private:
+	int _id = UNKNOWN_ID;
 };
+
+//
+// inlines
+//
+inline int Notification::id() const
+{
+	return _id;
+}
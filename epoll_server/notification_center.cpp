@@ -2,63 +2,229 @@
 #include "notification_center.h"
 #include "notification.h"
 #include "observer.h"
+#include "epoch_reclaimer.h"
 
+#include <algorithm>
+#include <optional>
+
+namespace
+{
+	/// 没有指定回收器的 NotificationCenter (例如 defaultCenter()) 被替换的快照都交给同一个回收器
+	EpochReclaimer& snapshotReclaimer()
+	{
+		static EpochReclaimer reclaimer;
+		return reclaimer;
+	}
+
+	/// 每个线程一个 epoch 记录, 第一次派发时分配, 线程退出时归还.
+	/// depth 是嵌套的派发层数, 只有最外层进出记录
+	struct ReaderSlot
+	{
+		EpochReclaimer::Record* pRecord = nullptr;
+		int depth = 0;
+
+		~ReaderSlot()
+		{
+			if (pRecord) snapshotReclaimer().detach(pRecord);
+		}
+	};
+
+	thread_local ReaderSlot readerSlot;
+}
+
+/// 派发期间在共享回收器上公开本线程所在的 epoch, 只写本线程的记录, 不与其它派发线程共享缓存行.
+/// 被替换的快照等到所有派发线程都离开替换时的 epoch 后才释放. active 为 false 时 (快照交给
+/// 调用者的回收器) 什么也不做
+class NotificationCenter::ReadGuard
+{
+public:
+	explicit ReadGuard(bool active)
+		: _active(active)
+	{
+		if (!_active || readerSlot.depth++ > 0) return;
+
+		if (!readerSlot.pRecord) readerSlot.pRecord = snapshotReclaimer().attach();
+		_guard.emplace(snapshotReclaimer(), readerSlot.pRecord);
+	}
+
+	~ReadGuard()
+	{
+		if (!_active || --readerSlot.depth > 0) return;
+
+		// 派发中增删的观察者只能在这里回收: 先离开 epoch, 再推进
+		_guard.reset();
+		if (snapshotReclaimer().pending() >= RECLAIM_BATCH) snapshotReclaimer().reclaim();
+	}
+
+	/// 持有 Guard 的线程不能推进 epoch, 在派发中修改观察者时留给最外层的 ReadGuard 回收
+	static bool inside()
+	{
+		return readerSlot.depth > 0;
+	}
+
+private:
+	bool _active;
+	std::optional<EpochReclaimer::Guard> _guard;
+};
+
+NotificationCenter::Snapshot::Snapshot(SlabAllocator* pAllocator)
+	: byId(SlabStlAllocator<ObserverListPtr>(pAllocator))
+{
+}
+
+NotificationCenter::ObserverList& NotificationCenter::Snapshot::modify(int id)
+{
+	ObserverListPtr* ppList = &untyped;
+	if (id >= 0)
+	{
+		if ((std::size_t)id >= byId.size()) byId.resize(id + 1);
+		ppList = &byId[id];
+	}
+	// 各组和快照使用同一个分配器
+	SlabAllocator* pAllocator = byId.get_allocator().allocator();
+	SlabStlAllocator<ObserverList> allocator(pAllocator);
+	*ppList = *ppList ? std::allocate_shared<ObserverList>(allocator, **ppList)
+		: std::allocate_shared<ObserverList>(allocator, SlabStlAllocator<AbstractObserverPtr>(pAllocator));
+	return **ppList;
+}
+
+const NotificationCenter::ObserverList* NotificationCenter::Snapshot::find(int id) const
+{
+	if (id < 0) return untyped.get();
+	return (std::size_t)id < byId.size() ? byId[id].get() : nullptr;
+}
+
+NotificationCenter::NotificationCenter(EpochReclaimer* pReclaimer, SlabAllocator* pAllocator)
+	: _pReclaimer(pReclaimer), _pAllocator(pAllocator), _pSnapshot(copy(Snapshot(pAllocator)))
+{
+}
+
+NotificationCenter::~NotificationCenter()
+{
+	delete _pSnapshot.load();
+}
 
 void NotificationCenter::addObserver(const AbstractObserver& observer)
 {
-	std::unique_lock<std::mutex> lock(_mutex);
-	_observers.push_back(observer.clone());
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		auto* pSnapshot = copy(*_pSnapshot.load());
+		pSnapshot->modify(observer.notificationId()).push_back(_pAllocator ? observer.clone(*_pAllocator) : observer.clone());
+		publish(pSnapshot);
+		_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	reclaim();
 }
 
 void NotificationCenter::removeObserver(const AbstractObserver& observer)
 {
-	std::unique_lock<std::mutex> lock(_mutex);
-	for (auto it = _observers.begin(); it != _observers.end(); ++it)
 	{
-		if (observer.equals(**it))
+		std::unique_lock<std::mutex> lock(_mutex);
+
+		const ObserverList* pList = _pSnapshot.load()->find(observer.notificationId());
+		if (!pList) return;
+
+		auto it = find(*pList, observer);
+		if (it == pList->end()) return;
+
+		// 正在派发的读者可能还持有旧快照, 先禁用, 之后的 notify 不再回调
+		(*it)->disable();
+
+		std::size_t index = it - pList->begin();
+		auto* pSnapshot = copy(*_pSnapshot.load());
+		if (pList->size() == 1)
 		{
-			(*it)->disable();
-			_observers.erase(it);
-			return;
+			int id = observer.notificationId();
+			(id < 0 ? pSnapshot->untyped : pSnapshot->byId[id]).reset();
 		}
+		else
+		{
+			ObserverList& list = pSnapshot->modify(observer.notificationId());
+			list.erase(list.begin() + index);
+		}
+		publish(pSnapshot);
+		_count.fetch_sub(1, std::memory_order_relaxed);
 	}
+	reclaim();
 }
 
 bool NotificationCenter::hasObserver(const AbstractObserver& observer) const
 {
 	std::unique_lock<std::mutex> lock(_mutex);
-	for (const auto& p : _observers)
-	{
-		if (observer.equals(*p)) return true;
-	}
 
-	return false;
+	// 持有 _mutex 时当前快照不会被替换
+	const ObserverList* pList = _pSnapshot.load()->find(observer.notificationId());
+	return pList && find(*pList, observer) != pList->end();
 }
 
-void NotificationCenter::postNotification(const Notification::Ptr& pNotification)
+void NotificationCenter::postNotification(Notification* pNotification)
 {
-	_mutex.lock();
-	ObserverList observersToNotify(_observers);
-	_mutex.unlock();
+	ReadGuard guard(!_pReclaimer);
 
-	for (auto& p : observersToNotify)
+	const Snapshot* pSnapshot = _pSnapshot.load();
+	int id = pNotification->id();
+	if (const ObserverList* pList = id >= 0 ? pSnapshot->find(id) : nullptr)
 	{
-		p->notify(pNotification.get());
+		for (const auto& p : *pList)
+		{
+			p->notify(pNotification);
+		}
+	}
+	if (pSnapshot->untyped)
+	{
+		for (const auto& p : *pSnapshot->untyped)
+		{
+			p->notify(pNotification);
+		}
 	}
 }
 
-bool NotificationCenter::hasObservers() const
+void NotificationCenter::postNotification(const Notification::Ptr& pNotification)
 {
-	std::unique_lock<std::mutex> lock(_mutex);
+	postNotification(pNotification.get());
+}
 
-	return !_observers.empty();
+bool NotificationCenter::hasObservers() const
+{
+	return _count.load(std::memory_order_relaxed) > 0;
 }
 
 std::size_t NotificationCenter::countObservers() const
 {
-	std::unique_lock<std::mutex> lock(_mutex);
+	return _count.load(std::memory_order_relaxed);
+}
+
+NotificationCenter::Snapshot* NotificationCenter::copy(const Snapshot& snapshot) const
+{
+	if (_pAllocator) return new (*_pAllocator) Snapshot(snapshot);
+	return new Snapshot(snapshot);
+}
+
+void NotificationCenter::publish(Snapshot* pSnapshot)
+{
+	// 替换之后才开始的读者只会看到新快照; 旧快照按替换时的 epoch 延迟释放
+	Snapshot* pOld = _pSnapshot.exchange(pSnapshot);
+	if (_pReclaimer) _pReclaimer->retire(pOld);
+	else snapshotReclaimer().retire(pOld);
+}
 
-	return _observers.size();
+void NotificationCenter::reclaim()
+{
+	// 调用者的回收器由它的所有者回收, 例如 SocketReactor 在每轮循环结束时
+	if (_pReclaimer) return;
+
+	// 攒够一批再推进 epoch, 写者不必每次都扫描所有派发线程的记录; 派发中的由最外层的 ReadGuard 回收
+	if (ReadGuard::inside() || snapshotReclaimer().pending() < RECLAIM_BATCH) return;
+	snapshotReclaimer().reclaim();
+}
+
+NotificationCenter::ObserverList::const_iterator NotificationCenter::find(const ObserverList& list,
+	const AbstractObserver& observer)
+{
+	const void* pObject = observer.object();
+	return std::find_if(list.begin(), list.end(), [&observer, pObject](const AbstractObserverPtr& p)
+	{ return p->object() == pObject && observer.equals(*p); });
 }
 
 NotificationCenter NotificationCenter::_defaultCenter;
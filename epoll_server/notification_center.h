@@ -2,17 +2,24 @@
 
 #include <vector>
 #include <mutex>
+#include <atomic>
 #include <memory>
 
 #include "notification.h"
 #include "observer.h"
+#include "slab_allocator.h"
 
+class EpochReclaimer;
 
 class NotificationCenter
 {
 public:
-	NotificationCenter() = default;
-	~NotificationCenter() = default;
+	/// pReclaimer 为空时被替换的快照交给进程内共享的回收器, 派发时自己公开 epoch.
+	/// 否则交给 pReclaimer (例如所属 SocketReactor 的回收器), 由它的所有者保证派发期间不回收:
+	/// 派发线程持有它的 Guard, 或者回收与派发在同一个线程中先后进行.
+	/// pAllocator 不为空时观察者副本和快照从中分配, 否则使用全局堆
+	explicit NotificationCenter(EpochReclaimer* pReclaimer = nullptr, SlabAllocator* pAllocator = nullptr);
+	~NotificationCenter();
 
 	static NotificationCenter& defaultCenter();
 
@@ -26,13 +33,53 @@ public:
 
 	std::size_t countObservers() const;
 
+	/// 通知对象仍归调用方所有
+	void postNotification(Notification* pNotification);
+
 	void postNotification(const Notification::Ptr& pNotification);
 
 private:
 	typedef AbstractObserver::Ptr AbstractObserverPtr;
-	typedef std::vector<AbstractObserverPtr> ObserverList;
+	typedef std::vector<AbstractObserverPtr, SlabStlAllocator<AbstractObserverPtr>> ObserverList;
+	typedef std::shared_ptr<ObserverList> ObserverListPtr;
+
+	/// 观察者列表的不可变快照. 按通知 ID 分组, 派发时只取对应的一组;
+	/// 没有编译期 ID 的观察者放在 untyped 中, 每次都参与匹配.
+	/// 各组在快照之间共享, 发布之后不再修改; 增删观察者只复制变化的那一组, 空组为空指针
+	struct Snapshot : public SlabAllocated
+	{
+		explicit Snapshot(SlabAllocator* pAllocator);
+
+		std::vector<ObserverListPtr, SlabStlAllocator<ObserverListPtr>> byId;
+		ObserverListPtr untyped;
+
+		/// 把 id 对应的一组换成可以修改的副本
+		ObserverList& modify(int id);
+		const ObserverList* find(int id) const;
+	};
+
+	class ReadGuard;
+
+	/// 在 _pAllocator 中 (为空时在全局堆中) 复制快照
+	Snapshot* copy(const Snapshot& snapshot) const;
+
+	/// 写者在 _mutex 下复制并替换快照, 被替换的快照交给 EpochReclaimer, 等所有派发线程离开后再释放
+	void publish(Snapshot* pSnapshot);
+
+	/// 不能在 _mutex 下调用: 释放快照会析构其中的观察者
+	void reclaim();
+
+	static ObserverList::const_iterator find(const ObserverList& list, const AbstractObserver& observer);
+
+	enum
+	{
+		RECLAIM_BATCH = 32
+	};
 
-	ObserverList _observers;
+	EpochReclaimer* _pReclaimer;
+	SlabAllocator* _pAllocator;
+	std::atomic<Snapshot*> _pSnapshot;
+	std::atomic<std::size_t> _count{ 0 };
 	mutable std::mutex _mutex;
 
 	static NotificationCenter _defaultCenter;
@@ -1,9 +1,28 @@
 #pragma once
 
 #include <memory>
-#include <mutex>
+#include <atomic>
+#include <concepts>
 #include "notification.h"
+#include "slab_allocator.h"
 
+/// 定义了 static constexpr int ID 的通知类型按 ID 匹配, 其余类型退回到 dynamic_cast
+template<class N>
+concept IdentifiedNotification = requires { { N::ID } -> std::convertible_to<int>; };
+
+template<class N>
+constexpr int notificationId()
+{
+	if constexpr (IdentifiedNotification<N>) return N::ID;
+	else return Notification::UNKNOWN_ID;
+}
+
+template<class N>
+N* notificationCast(Notification* pNf)
+{
+	if constexpr (IdentifiedNotification<N>) return pNf->id() == N::ID ? static_cast<N*>(pNf) : nullptr;
+	else return dynamic_cast<N*>(pNf);
+}
 
 class AbstractObserver
 {
@@ -19,7 +38,13 @@ public:
 	virtual void notify(Notification* pNf) const = 0;
 	virtual bool equals(const AbstractObserver& observer) const = 0;
 	virtual bool accepts(Notification* pNf, const char* pName = nullptr) const = 0;
+	/// 接收的通知 ID, 没有编译期 ID 时为 Notification::UNKNOWN_ID
+	virtual int notificationId() const = 0;
+	/// 观察的对象, 查找时先比较它再调用 equals()
+	virtual const void* object() const = 0;
 	virtual AbstractObserver::Ptr clone() const = 0;
+	/// 副本和引用计数的控制块一起放在 allocator 中
+	virtual AbstractObserver::Ptr clone(SlabAllocator& allocator) const = 0;
 	virtual void disable() = 0;
 };
 
@@ -37,7 +62,7 @@ public:
 	}
 
 	Observer(const Observer& observer)
-		: AbstractObserver(observer), _pObject(observer._pObject), _method(observer._method)
+		: AbstractObserver(observer), _pObject(observer._pObject.load(std::memory_order_acquire)), _method(observer._method)
 	{
 	}
 
@@ -47,7 +72,7 @@ public:
 	{
 		if (&observer != this)
 		{
-			_pObject = observer._pObject;
+			_pObject.store(observer._pObject.load(std::memory_order_acquire), std::memory_order_release);
 			_method = observer._method;
 		}
 		return *this;
@@ -55,15 +80,14 @@ public:
 
 	void notify(Notification* pNf) const override
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
-
-		if (_pObject)
+		C* pObject = _pObject.load(std::memory_order_acquire);
+		if (pObject)
 		{
-			N* pCastNf = dynamic_cast<N*>(pNf);
+			N* pCastNf = notificationCast<N>(pNf);
 			if (pCastNf)
 			{
 //				pCastNf->duplicate();
-				(_pObject->*_method)(pCastNf);
+				(pObject->*_method)(pCastNf);
 			}
 		}
 	}
@@ -71,30 +95,42 @@ public:
 	bool equals(const AbstractObserver& abstractObserver) const override
 	{
 		const auto* pObs = dynamic_cast<const Observer*>(&abstractObserver);
-		return pObs && pObs->_pObject == _pObject && pObs->_method == _method;
+		return pObs && pObs->object() == object() && pObs->_method == _method;
+	}
+
+	const void* object() const override
+	{
+		return _pObject.load(std::memory_order_acquire);
 	}
 
 	bool accepts(Notification* pNf, const char* pName) const override
 	{
-		return dynamic_cast<N*>(pNf) && (!pName || pNf->name() == pName);
+		return notificationCast<N>(pNf) && (!pName || pNf->name() == pName);
+	}
+
+	int notificationId() const override
+	{
+		return ::notificationId<N>();
 	}
 
 	AbstractObserver::Ptr clone() const override
 	{
-		return new Observer(*this);
+		return std::make_shared<Observer>(*this);
 	}
 
-	void disable() override
+	AbstractObserver::Ptr clone(SlabAllocator& allocator) const override
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
+		return std::allocate_shared<Observer>(SlabStlAllocator<Observer>(allocator), *this);
+	}
 
-		_pObject = 0;
+	void disable() override
+	{
+		_pObject.store(nullptr, std::memory_order_release);
 	}
 
 private:
-	C* _pObject;
+	std::atomic<C*> _pObject;
 	Callback _method;
-	mutable std::mutex _mutex;
 };
 
 template<class C, class N>
@@ -112,7 +148,7 @@ public:
 	}
 
 	NObserver(const NObserver& observer)
-		: AbstractObserver(observer), _pObject(observer._pObject), _method(observer._method)
+		: AbstractObserver(observer), _pObject(observer._pObject.load(std::memory_order_acquire)), _method(observer._method)
 	{
 	}
 
@@ -122,7 +158,7 @@ public:
 	{
 		if (&observer != this)
 		{
-			_pObject = observer._pObject;
+			_pObject.store(observer._pObject.load(std::memory_order_acquire), std::memory_order_release);
 			_method = observer._method;
 		}
 		return *this;
@@ -130,15 +166,15 @@ public:
 
 	void notify(Notification* pNf) const override
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
-
-		if (_pObject)
+		C* pObject = _pObject.load(std::memory_order_acquire);
+		if (pObject)
 		{
-			N* pCastNf = dynamic_cast<N*>(pNf);
+			N* pCastNf = notificationCast<N>(pNf);
 			if (pCastNf)
 			{
-				NotificationPtr ptr(pCastNf, true);
-				(_pObject->*_method)(ptr);
+				// 通知对象由派发方持有, 这里只是不增加引用计数的别名
+				NotificationPtr ptr(NotificationPtr(), pCastNf);
+				(pObject->*_method)(ptr);
 			}
 		}
 	}
@@ -146,27 +182,40 @@ public:
 	bool equals(const AbstractObserver& abstractObserver) const override
 	{
 		const auto* pObs = dynamic_cast<const NObserver*>(&abstractObserver);
-		return pObs && pObs->_pObject == _pObject && pObs->_method == _method;
+		return pObs && pObs->object() == object() && pObs->_method == _method;
+	}
+
+	const void* object() const override
+	{
+		return _pObject.load(std::memory_order_acquire);
 	}
 
 	bool accepts(Notification* pNf, const char* pName) const override
 	{
-		return dynamic_cast<N*>(pNf) && (!pName || pNf->name() == pName);
+		return notificationCast<N>(pNf) && (!pName || pNf->name() == pName);
+	}
+
+	int notificationId() const override
+	{
+		return ::notificationId<N>();
 	}
 
 	AbstractObserver::Ptr clone() const override
 	{
-		return new NObserver(*this);
+		return std::make_shared<NObserver>(*this);
+	}
+
+	AbstractObserver::Ptr clone(SlabAllocator& allocator) const override
+	{
+		return std::allocate_shared<NObserver>(SlabStlAllocator<NObserver>(allocator), *this);
 	}
 
 	void disable() override
 	{
-		std::unique_lock<std::mutex> lock(_mutex);
-		_pObject = nullptr;
+		_pObject.store(nullptr, std::memory_order_release);
 	}
 
 private:
-	C* _pObject;
+	std::atomic<C*> _pObject;
 	Callback _method;
-	mutable std::mutex _mutex;
 };
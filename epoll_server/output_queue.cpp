@@ -0,0 +1,99 @@
+
+#include "output_queue.h"
+#include "server_socket.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sys/socket.h>
+
+OutputQueue::OutputQueue(SlabAllocator& allocator)
+	: _allocator(allocator), _pHead(nullptr), _pTail(nullptr), _size(0)
+{
+}
+
+OutputQueue::~OutputQueue()
+{
+	clear();
+}
+
+void OutputQueue::append(const void* buffer, std::size_t length)
+{
+	const char* p = static_cast<const char*>(buffer);
+	while (length > 0)
+	{
+		// 小的响应接在最后一块的末尾, 块满了再取新块
+		if (!_pTail || _pTail->end == CHUNK_CAPACITY)
+		{
+			auto* pChunk = static_cast<Chunk*>(_allocator.allocate(CHUNK_SIZE));
+			pChunk->pNext = nullptr;
+			pChunk->begin = 0;
+			pChunk->end = 0;
+			if (_pTail) _pTail->pNext = pChunk;
+			else _pHead = pChunk;
+			_pTail = pChunk;
+		}
+
+		std::size_t n = std::min<std::size_t>(length, CHUNK_CAPACITY - _pTail->end);
+		std::memcpy(_pTail->data() + _pTail->end, p, n);
+		_pTail->end += n;
+		_size += n;
+		p += n;
+		length -= n;
+	}
+}
+
+bool OutputQueue::flush(const ServerSocket& socket, std::size_t limit)
+{
+	SocketBuf buffers[MAX_BUFFERS];
+	std::size_t remaining = limit > 0 ? limit : std::numeric_limits<std::size_t>::max();
+	while (_pHead && remaining > 0)
+	{
+		int count = 0;
+		std::size_t length = 0;
+		for (Chunk* pChunk = _pHead; pChunk && count < MAX_BUFFERS && length < remaining; pChunk = pChunk->pNext, ++count)
+		{
+			buffers[count].iov_base = pChunk->data() + pChunk->begin;
+			buffers[count].iov_len = std::min(pChunk->end - pChunk->begin, remaining - length);
+			length += buffers[count].iov_len;
+		}
+
+		// 一次提交不完时先不推送, 由内核把前后两次拼成整段; 剩下的留到下一轮时不能再压着
+		ssize_t rc = socket.sendNonBlocking(buffers, count, length < std::min(_size, remaining) ? MSG_MORE : 0);
+		if (rc < 0) return false;
+
+		consume(rc);
+		remaining -= rc;
+		if ((std::size_t)rc < length) return false;
+	}
+	return true;
+}
+
+void OutputQueue::clear()
+{
+	while (_pHead)
+	{
+		Chunk* pNext = _pHead->pNext;
+		_allocator.deallocate(_pHead, CHUNK_SIZE);
+		_pHead = pNext;
+	}
+	_pTail = nullptr;
+	_size = 0;
+}
+
+void OutputQueue::consume(std::size_t length)
+{
+	_size -= length;
+	while (length > 0)
+	{
+		std::size_t n = std::min(length, _pHead->end - _pHead->begin);
+		_pHead->begin += n;
+		length -= n;
+		if (_pHead->begin < _pHead->end) break;
+
+		Chunk* pNext = _pHead->pNext;
+		_allocator.deallocate(_pHead, CHUNK_SIZE);
+		_pHead = pNext;
+		if (!_pHead) _pTail = nullptr;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <boost/noncopyable.hpp>
+
+#include "slab_allocator.h"
+
+class ServerSocket;
+
+/// 连接的输出队列: SocketReactor::send() 把数据复制到从 Reactor 的 slab 中取的块里,
+/// 本轮派发结束时整个队列一次 sendmsg 发出. 只在 Reactor 线程中使用
+class OutputQueue : public boost::noncopyable
+{
+public:
+	explicit OutputQueue(SlabAllocator& allocator);
+	~OutputQueue();
+
+	void append(const void* buffer, std::size_t length);
+
+	/// 尽量发出队列中的数据, 每次 sendmsg 最多 MAX_BUFFERS 块, 本次还要接着发时带 MSG_MORE.
+	/// limit 大于 0 时最多发出 limit 字节, 达到后返回 true, 剩下的数据留在队列中.
+	/// 发送缓冲区满时返回 false, 剩下的数据留在队列中; 其它错误抛出异常
+	bool flush(const ServerSocket& socket, std::size_t limit = 0);
+
+	void clear();
+
+	std::size_t size() const;
+
+	bool empty() const;
+
+private:
+	/// 块头, 数据紧跟在后面
+	struct Chunk
+	{
+		Chunk* pNext;
+		std::size_t begin;
+		std::size_t end;
+
+		char* data();
+	};
+
+	enum
+	{
+		CHUNK_SIZE = SlabAllocator::MAX_SIZE,
+		CHUNK_CAPACITY = CHUNK_SIZE - sizeof(Chunk),
+		MAX_BUFFERS = 64
+	};
+
+	void consume(std::size_t length);
+
+	SlabAllocator& _allocator;
+	Chunk* _pHead;
+	Chunk* _pTail;
+	std::size_t _size;
+};
+
+//
+// inlines
+//
+inline std::size_t OutputQueue::size() const
+{
+	return _size;
+}
+
+inline bool OutputQueue::empty() const
+{
+	return _size == 0;
+}
+
+inline char* OutputQueue::Chunk::data()
+{
+	return reinterpret_cast<char*>(this + 1);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include "server_socket.h"
+#include "socket_reactor.h"
+#include "socket_reactor_pool.h"
+#include "observer.h"
+#include "socket_notification.h"
+
+/// 在一个 Reactor 上 accept, 然后把新连接交给 SocketReactorPool 中的某个工作 Reactor
+template<class ServiceHandler>
+class ParallelSocketAcceptor
+{
+public:
+	using AcceptObserver = Observer<ParallelSocketAcceptor, ReadableNotification>;
+
+	enum
+	{
+		DEFAULT_BATCH_SIZE = 64
+	};
+
+	/// 监听 socket 被设置为非阻塞, 每次可读时连续 accept 直到队列为空或达到批量上限.
+	/// 新连接经 postSocket() 交给目标 Reactor, 处理器在目标 Reactor 的线程中创建和注册, 不加锁的 Reactor 也可以使用
+	ParallelSocketAcceptor(ServerSocket& socket, SocketReactor& reactor, SocketReactorPool& pool)
+		: _socket(socket), _pReactor(&reactor), _pool(pool), _batchSize(DEFAULT_BATCH_SIZE)
+	{
+		_socket.setBlocking(false);
+		_pReactor->addEventHandler(_socket, AcceptObserver(*this, &ParallelSocketAcceptor::onAccept));
+	}
+
+	virtual ~ParallelSocketAcceptor()
+	{
+		try
+		{
+			unregisterAcceptor();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	virtual void registerAcceptor(SocketReactor& reactor)
+	{
+		_pReactor = &reactor;
+		if (!_pReactor->hasEventHandler(_socket, AcceptObserver(*this, &ParallelSocketAcceptor::onAccept)))
+		{
+			_pReactor->addEventHandler(_socket, AcceptObserver(*this, &ParallelSocketAcceptor::onAccept));
+		}
+	}
+
+	virtual void unregisterAcceptor()
+	{
+		if (_pReactor)
+		{
+			_pReactor->removeEventHandler(_socket, AcceptObserver(*this, &ParallelSocketAcceptor::onAccept));
+		}
+	}
+
+	void setBatchSize(std::size_t size)
+	{
+		_batchSize = size > 0 ? size : 1;
+	}
+
+	std::size_t getBatchSize() const
+	{
+		return _batchSize;
+	}
+
+	void onAccept(ReadableNotification* pNotification)
+	{
+		for (std::size_t i = 0; i < _batchSize; ++i)
+		{
+			int sockfd = _socket.acceptNonBlocking();
+			if (sockfd < 0) break;
+
+			// 处理器在工作 Reactor 的线程上创建和注册, 不与它的派发并发. 只传递 fd, 不分配任务对象;
+			// 交接没有执行 (Reactor 已停止) 时由工作 Reactor 的队列关闭连接
+			_pool.next().postSocket(sockfd, &ParallelSocketAcceptor::handOff, this);
+		}
+	}
+
+protected:
+	/// 在工作 Reactor 的线程中执行. 处理器复制 socket 并负责关闭; prepareSocket() 或构造失败时由 socket 关闭连接
+	static void handOff(void* pContext, SocketReactor& reactor, int sockfd)
+	{
+		ServerSocket socket(sockfd);
+		reactor.prepareSocket(socket);
+		static_cast<ParallelSocketAcceptor*>(pContext)->createServiceHandler(socket, reactor);
+		socket.release();
+	}
+
+	/// 继承 SlabAllocated 的处理器放在工作 Reactor 的 slab 中
+	virtual ServiceHandler* createServiceHandler(ServerSocket& socket, SocketReactor& reactor)
+	{
+		if constexpr (std::is_base_of_v<SlabAllocated, ServiceHandler>)
+			return new (reactor.allocator()) ServiceHandler(socket, reactor);
+		else
+			return new ServiceHandler(socket, reactor);
+	}
+
+	SocketReactor* reactor()
+	{
+		return _pReactor;
+	}
+
+	SocketReactorPool& pool()
+	{
+		return _pool;
+	}
+
+	ServerSocket& socket()
+	{
+		return _socket;
+	}
+
+private:
+	ServerSocket _socket;
+	SocketReactor* _pReactor;
+	SocketReactorPool& _pool;
+	std::size_t _batchSize;
+};
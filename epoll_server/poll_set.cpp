@@ -3,166 +3,356 @@
 #include "server_socket.h"
 #include "socket_defs.h"
 
-PollSet::PollSet()
-	: _epollfd(-1), _events(1024)
-{
-	create_epollfd();
-}
-
-PollSet::~PollSet()
-{
-	destroy_epollfd();
-}
+#include <cerrno>
+#include <climits>
+#include <sys/eventfd.h>
 
-void PollSet::add(const ServerSocket& socket, int mode)
+namespace
 {
-	std::lock_guard<std::mutex> guard(_mutex);
+	int epollTimeout(std::chrono::system_clock::duration timeout)
+	{
+		if (timeout < std::chrono::system_clock::duration::zero()) return -1;
 
-	int fd = socket.sockfd();
+		auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+		return ms > INT_MAX ? INT_MAX : static_cast<int>(ms);
+	}
 
-	struct epoll_event ev{ .events =  0 };
-	if (mode & PollSet::POLL_READ)
+	uint32_t pollEvents(int mode)
 	{
-		ev.events |= EPOLLIN;
+		uint32_t events = 0;
+		if (mode & PollSetBase::POLL_READ)
+		{
+			events |= EPOLLIN;
+		}
+		if (mode & PollSetBase::POLL_WRITE)
+		{
+			events |= EPOLLOUT;
+		}
+		if (mode & PollSetBase::POLL_ERROR)
+		{
+			events |= EPOLLERR;
+		}
+		if (mode & PollSetBase::POLL_EDGE)
+		{
+			events |= EPOLLRDHUP;
+		}
+		return events;
 	}
-	if (mode & PollSet::POLL_WRITE)
+
+	int readyMode(uint32_t events)
 	{
-		ev.events |= EPOLLOUT;
+		int mode = 0;
+		if (events & (EPOLLIN | EPOLLRDHUP))
+			mode |= PollSetBase::POLL_READ;
+		if (events & EPOLLOUT)
+			mode |= PollSetBase::POLL_WRITE;
+		if (events & EPOLLERR)
+			mode |= PollSetBase::POLL_ERROR;
+		return mode;
 	}
-	if (mode & PollSet::POLL_ERROR)
+
+	uint64_t userData(int fd, uint32_t generation)
 	{
-		ev.events |= EPOLLERR;
+		return (uint64_t(generation) << 32) | uint32_t(fd);
 	}
-	ev.data.ptr = (void*)&socket;
+}
 
-	int err = epoll_ctl(_epollfd, EPOLL_CTL_ADD, fd, &ev);
-	if (err)
+std::atomic<PollSetBase::Backend> PollSetBase::_defaultBackend(PollSetBase::BACKEND_EPOLL);
+
+template<class ThreadingPolicy>
+BasicPollSet<ThreadingPolicy>::BasicPollSet(Backend backend)
+	: _backend(BACKEND_EPOLL), _epollfd(-1), _eventfd(-1), _count(0), _multishot(true), _polling(false)
+{
+	create_eventfd();
+	if (backend == BACKEND_URING && IoUring::supported())
 	{
-		if (errno == EEXIST) update(socket, mode);
-		else ServerSocket::error();
+		_backend = BACKEND_URING;
+		create_uring();
 	}
-
-	if (_socketMap.find(socket) == _socketMap.end())
+	else
 	{
-		_socketMap[socket] = socket;
+		create_epollfd();
 	}
 }
 
-void PollSet::remove(const ServerSocket& socket)
+template<class ThreadingPolicy>
+BasicPollSet<ThreadingPolicy>::~BasicPollSet()
 {
-	std::lock_guard<std::mutex> guard(_mutex);
-
-	auto fd = socket.sockfd();
-	struct epoll_event ev{ 0, { nullptr }};
-	int err = epoll_ctl(_epollfd, EPOLL_CTL_DEL, fd, &ev);
-	if (err) ServerSocket::error();
-
-	_socketMap.erase(socket);
+	_pRing.reset();
+	destroy_epollfd();
+	destroy_eventfd();
 }
 
-void PollSet::update(const ServerSocket& socket, int mode)
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::add(const ServerSocket& socket, int mode, void* pData)
 {
+	std::lock_guard<Mutex> guard(_mutex);
+
 	int fd = socket.sockfd();
+	if (fd < 0) return;
 
-	struct epoll_event ev{ .events =  0 };
-	ev.events = 0;
-	if (mode & PollSet::POLL_READ)
+	bool registered = (std::size_t)fd < _registered.size() && _registered[fd];
+	if (_pRing)
+	{
+		if ((std::size_t)fd >= _slots.size()) _slots.resize(fd + 1);
+
+		Slot& slot = _slots[fd];
+		disarm(fd, slot);
+		slot.pData = pData;
+		slot.mode = mode;
+		arm(fd, slot);
+		submitIfPolling();
+	}
+	else
 	{
-		ev.events |= EPOLLIN;
+		ctl(registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, mode, pData);
 	}
-	if (mode & PollSet::POLL_WRITE)
+	if (registered) return;
+
+	if ((std::size_t)fd >= _registered.size()) _registered.resize(fd + 1, false);
+	_registered[fd] = true;
+	++_count;
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::remove(const ServerSocket& socket)
+{
+	std::lock_guard<Mutex> guard(_mutex);
+
+	auto fd = socket.sockfd();
+	bool registered = fd >= 0 && (std::size_t)fd < _registered.size() && _registered[fd];
+	int err = 0;
+	if (_pRing)
 	{
-		ev.events |= EPOLLOUT;
+		if (registered)
+		{
+			disarm(fd, _slots[fd]);
+			submitIfPolling();
+		}
 	}
-	if (mode & PollSet::POLL_ERROR)
+	else
 	{
-		ev.events |= EPOLLERR;
+		struct epoll_event ev{ 0, { nullptr }};
+		err = epoll_ctl(_epollfd, EPOLL_CTL_DEL, fd, &ev);
+	}
 
+	if (registered)
+	{
+		_registered[fd] = false;
+		--_count;
 	}
-	ev.data.ptr = (void*)&socket;
 
-	int err = epoll_ctl(_epollfd, EPOLL_CTL_MOD, fd, &ev);
-	if (err)
+	if (err) ServerSocket::error();
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::update(const ServerSocket& socket, int mode, void* pData)
+{
+	if (!_pRing)
 	{
-		ServerSocket::error();
+		ctl(EPOLL_CTL_MOD, socket.sockfd(), mode, pData);
+		return;
 	}
+
+	std::lock_guard<Mutex> guard(_mutex);
+
+	int fd = socket.sockfd();
+	if (fd < 0 || (std::size_t)fd >= _registered.size() || !_registered[fd]) ServerSocket::error(ENOENT);
+
+	// 一次性注册在完成后已经失效, 这里只需重新提交; 否则先取消仍在等待的 poll
+	Slot& slot = _slots[fd];
+	disarm(fd, slot);
+	slot.pData = pData;
+	slot.mode = mode;
+	arm(fd, slot);
+	submitIfPolling();
 }
 
-bool PollSet::has(const ServerSocket& socket) const
+template<class ThreadingPolicy>
+bool BasicPollSet<ThreadingPolicy>::has(const ServerSocket& socket) const
 {
-	std::lock_guard<std::mutex> guard(_mutex);
-	return (_socketMap.find(socket) != _socketMap.end());
+	std::lock_guard<Mutex> guard(_mutex);
+	int fd = socket.sockfd();
+	return fd >= 0 && (std::size_t)fd < _registered.size() && _registered[fd];
 }
 
-bool PollSet::empty() const
+template<class ThreadingPolicy>
+bool BasicPollSet<ThreadingPolicy>::empty() const
 {
-	std::lock_guard<std::mutex> guard(_mutex);
-	return _socketMap.empty();
+	std::lock_guard<Mutex> guard(_mutex);
+	return _count == 0;
 }
 
-void PollSet::clear()
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::clear()
 {
-	std::lock_guard<std::mutex> guard(_mutex);
+	std::lock_guard<Mutex> guard(_mutex);
 
-	_socketMap.clear();
+	_registered.clear();
+	_count = 0;
 
-	::close(_epollfd);
-	_epollfd = epoll_create(1);
-	if (_epollfd < 0)
+	if (_pRing)
 	{
-		ServerSocket::error();
+		_slots.clear();
+		create_uring();
+	}
+	else
+	{
+		destroy_epollfd();
+		create_epollfd();
 	}
 }
 
-PollSet::SocketModeMap PollSet::poll(std::chrono::system_clock::duration timeout)
+template<class ThreadingPolicy>
+PollSetBase::EventSpan BasicPollSet<ThreadingPolicy>::poll(std::chrono::system_clock::duration timeout)
 {
-	PollSet::SocketModeMap result;
+	return poll(timeout, _buffer);
+}
 
-	{
-		std::lock_guard<std::mutex> guard(_mutex);
-		if (_socketMap.empty()) return result;
-	}
+template<class ThreadingPolicy>
+PollSetBase::EventSpan BasicPollSet<ThreadingPolicy>::poll(std::chrono::system_clock::duration timeout, EventBuffer& buffer)
+{
+	if (_pRing) return pollUring(timeout, buffer);
 
+	auto& events = buffer.events;
+	// 阻塞等待, 直到有事件、超时或者被 wakeUp() 唤醒
+	auto deadline = std::chrono::steady_clock::now() + timeout;
 	int rc;
 	do
 	{
-		rc = epoll_wait(_epollfd, &_events[0], _events.size(), 0);
+		rc = epoll_wait(_epollfd, &events[0], (int)events.size(), epollTimeout(timeout));
 		if (rc < 0 && ServerSocket::lastError() == EINTR)
 		{
-			continue;
+			if (timeout > std::chrono::system_clock::duration::zero())
+			{
+				timeout = std::chrono::duration_cast<std::chrono::system_clock::duration>(
+					deadline - std::chrono::steady_clock::now());
+				if (timeout < std::chrono::system_clock::duration::zero())
+					timeout = std::chrono::system_clock::duration::zero();
+			}
 		}
 	} while (rc < 0 && ServerSocket::lastError() == EINTR);
 	if (rc < 0) ServerSocket::error();
 
-	std::lock_guard<std::mutex> guard(_mutex);
-
+	std::size_t count = 0;
 	for (int i = 0; i < rc; i++)
 	{
-		auto it = _socketMap.find(_events[i].data.ptr);
-		if (it != _socketMap.end())
+		if (events[i].data.ptr == &_eventfd)
 		{
-			if (_events[i].events & EPOLLIN)
-				result[it->second] |= PollSet::POLL_READ;
-			if (_events[i].events & EPOLLOUT)
-				result[it->second] |= PollSet::POLL_WRITE;
-			if (_events[i].events & EPOLLERR)
-				result[it->second] |= PollSet::POLL_ERROR;
+			drain_eventfd();
+			continue;
 		}
+
+		Event& event = buffer.ready[count++];
+		event.pData = events[i].data.ptr;
+		event.mode = readyMode(events[i].events);
 	}
 
-	return result;
+	return { buffer.ready.data(), count };
 }
 
-void PollSet::create_epollfd()
+template<class ThreadingPolicy>
+PollSetBase::EventSpan BasicPollSet<ThreadingPolicy>::pollUring(std::chrono::system_clock::duration timeout, EventBuffer& buffer)
 {
-	_epollfd = epoll_create(1);
+	// 本轮之前的注册变更随等待一起提交; 等待期间其它线程的变更由它们自己提交
+	unsigned toSubmit;
+	{
+		std::lock_guard<Mutex> guard(_mutex);
+		toSubmit = _pRing->flush();
+		_polling.store(true);
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (_pRing->wait(toSubmit, 1, timeout) < 0)
+	{
+		toSubmit = 0;
+		if (timeout > std::chrono::system_clock::duration::zero())
+		{
+			timeout = std::chrono::duration_cast<std::chrono::system_clock::duration>(
+				deadline - std::chrono::steady_clock::now());
+			if (timeout < std::chrono::system_clock::duration::zero())
+				timeout = std::chrono::system_clock::duration::zero();
+		}
+	}
+
+	std::lock_guard<Mutex> guard(_mutex);
+	_polling.store(false);
+
+	std::size_t count = 0;
+	while (count < buffer.ready.size())
+	{
+		io_uring_cqe* pCqe = _pRing->peekCqe();
+		if (!pCqe) break;
+
+		uint64_t data = pCqe->user_data;
+		int res = pCqe->res;
+		bool more = pCqe->flags & IORING_CQE_F_MORE;
+		_pRing->advance();
+
+		if (data == WAKEUP_TAG)
+		{
+			if (res == -EINVAL) _multishot = false;
+			drain_eventfd();
+			if (!more) armWakeUp();
+			continue;
+		}
+		if (data == CANCEL_TAG) continue;
+
+		// 已移除或重新注册的 fd: 完成事件属于已经取消的 poll
+		int fd = int(uint32_t(data));
+		if ((std::size_t)fd >= _registered.size() || !_registered[fd]) continue;
+		Slot& slot = _slots[fd];
+		if (slot.generation != uint32_t(data >> 32)) continue;
+
+		if (!more)
+		{
+			slot.armed = false;
+			if (res == -EINVAL && _multishot && (slot.mode & POLL_EDGE))
+			{
+				// 内核不支持 multishot poll (5.13 之前), 之后都以单次 poll 重新提交
+				_multishot = false;
+				arm(fd, slot);
+				continue;
+			}
+			if (!(slot.mode & POLL_ONESHOT)) arm(fd, slot);
+			if (res == -ECANCELED) continue;
+		}
+
+		Event& event = buffer.ready[count++];
+		event.pData = slot.pData;
+		event.mode = res < 0 ? PollSetBase::POLL_ERROR : readyMode(uint32_t(res));
+	}
+
+	return { buffer.ready.data(), count };
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::wakeUp()
+{
+	uint64_t val = 1;
+	ssize_t n = ::write(_eventfd, &val, sizeof(val));
+	(void)n;
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::create_epollfd()
+{
+	_epollfd = epoll_create1(EPOLL_CLOEXEC);
 	if (_epollfd < 0)
 	{
 		ServerSocket::error();
 	}
+
+	struct epoll_event ev{ .events = EPOLLIN };
+	ev.data.ptr = &_eventfd;
+	if (epoll_ctl(_epollfd, EPOLL_CTL_ADD, _eventfd, &ev) != 0)
+	{
+		ServerSocket::error();
+	}
 }
 
-void PollSet::destroy_epollfd()
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::destroy_epollfd()
 {
 	if (_epollfd >= 0)
 	{
@@ -170,3 +360,119 @@ void PollSet::destroy_epollfd()
 		_epollfd = -1;
 	}
 }
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::create_eventfd()
+{
+	_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventfd < 0)
+	{
+		ServerSocket::error();
+	}
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::destroy_eventfd()
+{
+	if (_eventfd >= 0)
+	{
+		::close(_eventfd);
+		_eventfd = -1;
+	}
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::drain_eventfd()
+{
+	uint64_t val;
+	ssize_t n = ::read(_eventfd, &val, sizeof(val));
+	(void)n;
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::ctl(int op, int fd, int mode, void* pData)
+{
+	struct epoll_event ev{ .events = pollEvents(mode) };
+	if (mode & PollSetBase::POLL_EDGE)
+	{
+		ev.events |= EPOLLET;
+	}
+	if (mode & PollSetBase::POLL_ONESHOT)
+	{
+		ev.events |= EPOLLONESHOT;
+	}
+	ev.data.ptr = pData;
+
+	int err = epoll_ctl(_epollfd, op, fd, &ev);
+	if (err)
+	{
+		ServerSocket::error();
+	}
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::create_uring()
+{
+	_pRing.reset();
+	_pRing = std::make_unique<IoUring>();
+	armWakeUp();
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::arm(int fd, Slot& slot)
+{
+	if (!(slot.mode & (POLL_READ | POLL_WRITE | POLL_ERROR))) return;
+
+	io_uring_sqe* pSqe = _pRing->getSqe();
+	if (!pSqe) ServerSocket::error(EBUSY);
+
+	pSqe->opcode = IORING_OP_POLL_ADD;
+	pSqe->fd = fd;
+	pSqe->poll32_events = pollEvents(slot.mode);
+	// 水平触发必须每次重新提交: multishot poll 只在新的唤醒时上报, 不会重复上报仍然就绪的 fd
+	if ((slot.mode & POLL_EDGE) && !(slot.mode & POLL_ONESHOT) && _multishot)
+	{
+		pSqe->poll32_events |= EPOLLET;
+		pSqe->len = IORING_POLL_ADD_MULTI;
+	}
+	pSqe->user_data = userData(fd, slot.generation);
+	slot.armed = true;
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::disarm(int fd, Slot& slot)
+{
+	if (!slot.armed) return;
+
+	io_uring_sqe* pSqe = _pRing->getSqe();
+	if (!pSqe) ServerSocket::error(EBUSY);
+
+	pSqe->opcode = IORING_OP_POLL_REMOVE;
+	pSqe->fd = -1;
+	pSqe->addr = userData(fd, slot.generation);
+	pSqe->user_data = CANCEL_TAG;
+	slot.armed = false;
+	++slot.generation;
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::armWakeUp()
+{
+	io_uring_sqe* pSqe = _pRing->getSqe();
+	if (!pSqe) ServerSocket::error(EBUSY);
+
+	pSqe->opcode = IORING_OP_POLL_ADD;
+	pSqe->fd = _eventfd;
+	pSqe->poll32_events = EPOLLIN;
+	if (_multishot) pSqe->len = IORING_POLL_ADD_MULTI;
+	pSqe->user_data = WAKEUP_TAG;
+}
+
+template<class ThreadingPolicy>
+void BasicPollSet<ThreadingPolicy>::submitIfPolling()
+{
+	if (_polling.load()) _pRing->submit();
+}
+
+template class BasicPollSet<MultiThreaded>;
+template class BasicPollSet<SingleThreaded>;
@@ -2,34 +2,90 @@
 
 #include <boost/noncopyable.hpp>
 #include <boost/enable_shared_from_this.hpp>
-#include <map>
-#include <set>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
+#include <span>
+#include <vector>
+#include <chrono>
 #include <sys/socket.h>
 #include <sys/epoll.h>
 
 #include "server_socket.h"
+#include "threading.h"
+#include "uring.h"
 
-class PollSet : public boost::noncopyable
+/// 与线程模型无关的定义
+class PollSetBase
 {
 public:
 	enum Mode
 	{
 		POLL_READ = 0x01,
 		POLL_WRITE = 0x02,
-		POLL_ERROR = 0x04
+		POLL_ERROR = 0x04,
+		POLL_EDGE = 0x08,   /// 边缘触发注册 (EPOLLET | EPOLLRDHUP), 对端关闭按可读上报
+		POLL_ONESHOT = 0x10 /// 触发一次后停止上报, 直到再次 update()
 	};
 
-	using SocketModeMap = std::map<ServerSocket, int>;
+	/// 多路复用的实现, 在构造时选择
+	enum Backend
+	{
+		BACKEND_EPOLL,
+		BACKEND_URING /// io_uring poll, 内核不支持时自动退回 epoll
+	};
+
+	/// 就绪事件, pData 为注册时传入的长生命周期记录 (例如 SocketNotifier)
+	struct Event
+	{
+		void* pData;
+		int mode;
+	};
+
+	using EventSpan = std::span<const Event>;
+
+	/// poll() 使用的事件缓冲区; 多个线程轮流 poll 时每个线程各用一个
+	struct EventBuffer
+	{
+		explicit EventBuffer(std::size_t capacity = 1024)
+			: events(capacity), ready(capacity)
+		{
+		}
+
+		std::vector<struct epoll_event> events;
+		std::vector<Event> ready;
+	};
+
+	/// 之后创建的 PollSet 默认使用的实现, 在启动时设置
+	static void setDefaultBackend(Backend backend);
+	static Backend defaultBackend();
 
-	PollSet();
-	~PollSet();
+private:
+	static std::atomic<Backend> _defaultBackend;
+};
+
+/// ThreadingPolicy 为 SingleThreaded 时注册表不加锁, 只能在一个线程中使用 (wakeUp() 除外).
+///
+/// io_uring 实现与 epoll 的 add/remove/update/poll 语义相同:
+/// 每个 fd 提交一个 IORING_OP_POLL_ADD, 边缘触发时使用 multishot poll, 水平触发时在每次完成后重新提交
+/// (提交时内核会重新检查就绪状态). 注册变更只写入提交队列, 与下一次 poll() 的等待合并为一次 io_uring_enter;
+/// 只有其它线程在另一个线程阻塞于 poll() 期间修改注册时才立即提交.
+template<class ThreadingPolicy>
+class BasicPollSet : public PollSetBase, public boost::noncopyable
+{
+public:
+	explicit BasicPollSet(Backend backend = defaultBackend());
+	~BasicPollSet();
+
+	/// 实际使用的实现
+	Backend backend() const;
 
-	void add(const ServerSocket& socket, int mode);
+	void add(const ServerSocket& socket, int mode, void* pData);
 
 	void remove(const ServerSocket& socket);
 
-	void update(const ServerSocket& socket, int mode);
+	void update(const ServerSocket& socket, int mode, void* pData);
 
 	bool has(const ServerSocket& socket) const;
 
@@ -37,22 +93,91 @@ public:
 
 	void clear();
 
-	SocketModeMap poll(std::chrono::system_clock::duration timeout);
+	/// 返回的事件数组由 PollSet 持有, 在下一次调用 poll() 之前有效
+	EventSpan poll(std::chrono::system_clock::duration timeout);
+
+	/// 返回的事件数组由 buffer 持有
+	EventSpan poll(std::chrono::system_clock::duration timeout, EventBuffer& buffer);
+
+	void wakeUp();
 
 private:
+	typedef typename ThreadingPolicy::Mutex Mutex;
+
 	void create_epollfd();
 
 	void destroy_epollfd();
 
+	void create_eventfd();
+
+	void destroy_eventfd();
+
+	void drain_eventfd();
+
+	void ctl(int op, int fd, int mode, void* pData);
+
+	/// io_uring 中每个 fd 的注册记录; generation 写入 user_data 的高 32 位, 用于丢弃已取消的 poll 的完成事件
+	struct Slot
+	{
+		void* pData = nullptr;
+		int mode = 0;
+		uint32_t generation = 0;
+		bool armed = false;
+	};
+
+	static constexpr uint64_t WAKEUP_TAG = ~uint64_t(0);
+	static constexpr uint64_t CANCEL_TAG = ~uint64_t(0) - 1;
+
+	void create_uring();
+
+	void arm(int fd, Slot& slot);
+
+	void disarm(int fd, Slot& slot);
+
+	void armWakeUp();
+
+	void submitIfPolling();
+
+	EventSpan pollUring(std::chrono::system_clock::duration timeout, EventBuffer& buffer);
+
 private:
-	mutable std::mutex _mutex;
+	mutable Mutex _mutex;
+
+	Backend _backend;
 
 	int _epollfd;
+	int _eventfd;
+
+	using RegisteredArray = std::vector<bool>;
 
-	using ServerSocketMap = std::map<void*, ServerSocket>;
-	using ServerSocketSet = std::set<ServerSocket>;
-	using EpollEventArray = std::vector<struct epoll_event>;
+	RegisteredArray _registered;
+	std::size_t _count;
 
-	ServerSocketMap _socketMap;
-	EpollEventArray _events;
+	EventBuffer _buffer;
+
+	std::unique_ptr<IoUring> _pRing;
+	std::vector<Slot> _slots;
+	bool _multishot;
+	std::atomic<bool> _polling;
 };
+
+//
+// inlines
+//
+inline void PollSetBase::setDefaultBackend(Backend backend)
+{
+	_defaultBackend.store(backend, std::memory_order_relaxed);
+}
+
+inline PollSetBase::Backend PollSetBase::defaultBackend()
+{
+	return _defaultBackend.load(std::memory_order_relaxed);
+}
+
+template<class ThreadingPolicy>
+inline PollSetBase::Backend BasicPollSet<ThreadingPolicy>::backend() const
+{
+	return _backend;
+}
+
+typedef BasicPollSet<DefaultThreadingPolicy> PollSet;
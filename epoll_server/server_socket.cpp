@@ -1,5 +1,7 @@
 #include "server_socket.h"
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include <fcntl.h>
 #include <unistd.h>
@@ -13,6 +15,8 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 
+#include <linux/filter.h>
+
 #include "socket_defs.h"
 
 struct sockaddr_in make_addr(uint16_t port)
@@ -68,6 +72,13 @@ void ServerSocket::close()
 	}
 }
 
+int ServerSocket::release()
+{
+	int sockfd = _sockfd;
+	_sockfd = INVALID_SOCKET;
+	return sockfd;
+}
+
 bool ServerSocket::shutdownReceive()
 {
 	int rc = ::shutdown(_sockfd, 0);
@@ -144,15 +155,6 @@ ssize_t ServerSocket::receiveBytes(SocketBufVec& buffers, int flags)
 	return rc;
 }
 
-ssize_t ServerSocket::receiveBytes(FIFOBuffer& fifoBuf)
-{
-	std::unique_lock<std::mutex> lock(fifoBuf.mutex());
-
-	ssize_t ret = receiveBytes(fifoBuf.next(), (int)fifoBuf.available());
-	if (ret > 0) fifoBuf.advance(ret);
-	return ret;
-}
-
 ssize_t ServerSocket::sendBytes(const void* buffer, int length, int flags)
 {
 	ssize_t rc;
@@ -180,13 +182,25 @@ ssize_t ServerSocket::sendBytes(const SocketBufVec& buffers, int flags)
 	return rc;
 }
 
-ssize_t ServerSocket::sendBytes(FIFOBuffer& fifoBuf)
+ssize_t ServerSocket::sendNonBlocking(const SocketBuf* buffers, int count, int flags) const
 {
-	std::unique_lock<std::mutex> lock(fifoBuf.mutex());
+	if (_sockfd == INVALID_SOCKET) throw std::runtime_error("invalid socket");
 
-	ssize_t ret = sendBytes(fifoBuf.begin(), (int)fifoBuf.used());
-	if (ret > 0) fifoBuf.drain(ret);
-	return ret;
+	msghdr msg{};
+	msg.msg_iov = const_cast<SocketBuf*>(buffers);
+	msg.msg_iovlen = count;
+
+	ssize_t rc;
+	do
+	{
+		rc = ::sendmsg(_sockfd, &msg, flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (rc < 0 && lastError() == EINTR);
+	if (rc >= 0) return rc;
+
+	int err = lastError();
+	if (err == EAGAIN || err == EWOULDBLOCK) return -1;
+	error(err);
+	return -1;
 }
 
 ServerSocket::Ptr ServerSocket::acceptConnection(sockaddr_in& clientAddr)
@@ -212,6 +226,23 @@ ServerSocket::Ptr ServerSocket::acceptConnection(sockaddr_in& clientAddr)
 	return nullptr;
 }
 
+int ServerSocket::acceptNonBlocking()
+{
+	if (_sockfd == INVALID_SOCKET) return -1;
+
+	int sd;
+	do
+	{
+		sd = ::accept4(_sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	} while (sd == -1 && lastError() == EINTR);
+	if (sd != -1) return sd;
+
+	int err = lastError();
+	if (err == EAGAIN || err == EWOULDBLOCK || err == ECONNABORTED) return -1;
+	error(err);
+	return -1;
+}
+
 void ServerSocket::connect(const std::string& ip, uint16_t port)
 {
 	if (_sockfd == INVALID_SOCKET)
@@ -575,6 +606,54 @@ bool ServerSocket::getReusePort()
 #endif
 }
 
+void ServerSocket::setBusyPoll(int usecs, bool prefer)
+{
+#ifdef SO_BUSY_POLL
+	setOption(SOL_SOCKET, SO_BUSY_POLL, usecs);
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+	if (prefer) setOption(SOL_SOCKET, SO_PREFER_BUSY_POLL, 1);
+#endif
+}
+
+int ServerSocket::getBusyPoll()
+{
+	int value(0);
+#ifdef SO_BUSY_POLL
+	getOption(SOL_SOCKET, SO_BUSY_POLL, value);
+#endif
+	return value;
+}
+
+void ServerSocket::attachReusePortCpuFilter(const std::vector<int>& cpus)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	// 按处理该数据包的 CPU 查表: 每个绑定的 CPU 生成 "jeq #cpu; ret #index", 同一个 CPU 取第一个 socket.
+	// 表中没有的 CPU 返回 cpus.size(), 超出分组范围, 内核退回按哈希选择
+	std::vector<struct sock_filter> code;
+	code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+	std::vector<int> seen;
+	for (std::size_t i = 0; i < cpus.size(); ++i)
+	{
+		int cpu = cpus[i];
+		if (cpu < 0 || std::find(seen.begin(), seen.end(), cpu) != seen.end()) continue;
+		seen.push_back(cpu);
+
+		code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)cpu, 0, 1));
+		code.push_back(BPF_STMT(BPF_RET | BPF_K, (uint32_t)i));
+	}
+	code.push_back(BPF_STMT(BPF_RET | BPF_K, (uint32_t)cpus.size()));
+	if (code.size() > BPF_MAXINSNS) error(E2BIG);
+
+	struct sock_fprog prog{};
+	prog.len = (unsigned short)code.size();
+	prog.filter = code.data();
+	setRawOption(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+#else
+	throw std::runtime_error("SO_ATTACH_REUSEPORT_CBPF not defined.");
+#endif
+}
+
 void ServerSocket::setOOBInline(bool flag)
 {
 	int value = flag ? 1 : 0;
@@ -2,6 +2,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <unistd.h>
 #include <memory>
 
@@ -51,6 +52,9 @@ public:
 
 	void close();
 
+	/// 放弃 fd 的所有权: 不关闭, 返回原来的 fd
+	int release();
+
 	void connect(const std::string& ip, uint16_t port);
 	void connectNB(const std::string& ip, uint16_t port);
 
@@ -63,13 +67,30 @@ public:
 
 	ServerSocket::Ptr acceptConnection(struct sockaddr_in& clientAddr);
 
+	/// accept4(SOCK_NONBLOCK | SOCK_CLOEXEC), 新连接不需要再调用 fcntl. 监听 socket 应为非阻塞;
+	/// 队列为空或连接在 accept 之前已被对端重置时返回 -1, 其它错误抛出异常
+	int acceptNonBlocking();
+
 	ssize_t sendBytes(const void* buffer, int length, int flags = 0);
 	ssize_t sendBytes(const SocketBufVec& buffers, int flags);
-	ssize_t sendBytes(FIFOBuffer& buffer);
+
+	/// sendmsg(MSG_DONTWAIT | MSG_NOSIGNAL), flags 可带 MSG_MORE. 发送缓冲区满时返回 -1, 其它错误抛出异常
+	ssize_t sendNonBlocking(const SocketBuf* buffers, int count, int flags = 0) const;
+	template<class Mutex>
+	ssize_t sendBytes(BasicFIFOBuffer<char, Mutex>& buffer);
 
 	ssize_t receiveBytes(void* buffer, int length, int flags = 0);
 	ssize_t receiveBytes(SocketBufVec& buffers, int flags);
-	ssize_t receiveBytes(FIFOBuffer& buffer);
+	template<class Mutex>
+	ssize_t receiveBytes(BasicFIFOBuffer<char, Mutex>& buffer);
+
+	/// 边缘触发用: 读到 EAGAIN、EOF 或缓冲区满为止, drained 表示是否已经读到 EAGAIN
+	template<class Mutex>
+	ssize_t receiveAll(BasicFIFOBuffer<char, Mutex>& buffer, bool& drained);
+
+	/// 边缘触发用: 写到缓冲区为空或 EAGAIN 为止, drained 表示缓冲区是否已经写空
+	template<class Mutex>
+	ssize_t sendAll(BasicFIFOBuffer<char, Mutex>& buffer, bool& drained);
 
 public:
 	void setOption(int level, int option, int value);
@@ -97,6 +118,15 @@ public:
 	void setReusePort(bool flag);
 	bool getReusePort();
 
+	/// SO_ATTACH_REUSEPORT_CBPF: 在 CPU cpus[i] 上处理的连接交给分组中第 i 个 socket.
+	/// cpus[i] < 0 表示第 i 个 socket 不参与; 其它 CPU 上的连接由内核按哈希分配
+	void attachReusePortCpuFilter(const std::vector<int>& cpus);
+
+	/// SO_BUSY_POLL: 阻塞读时在驱动队列上忙等的微秒数, prefer 时同时设置 SO_PREFER_BUSY_POLL.
+	/// 超过 net.core.busy_poll 需要 CAP_NET_ADMIN, 失败时抛出异常
+	void setBusyPoll(int usecs, bool prefer = false);
+	int getBusyPoll();
+
 	void setOOBInline(bool flag);
 	bool getOOBInline();
 
@@ -170,3 +200,74 @@ inline bool ServerSocket::operator>=(const ServerSocket& socket) const
 {
 	return _sockfd >= socket._sockfd;
 }
+
+template<class Mutex>
+inline ssize_t ServerSocket::receiveBytes(BasicFIFOBuffer<char, Mutex>& fifoBuf)
+{
+	std::unique_lock<Mutex> lock(fifoBuf.mutex());
+
+	ssize_t ret = receiveBytes(fifoBuf.next(), (int)fifoBuf.available());
+	if (ret > 0) fifoBuf.advance(ret);
+	return ret;
+}
+
+template<class Mutex>
+inline ssize_t ServerSocket::sendBytes(BasicFIFOBuffer<char, Mutex>& fifoBuf)
+{
+	std::unique_lock<Mutex> lock(fifoBuf.mutex());
+
+	ssize_t ret = sendBytes(fifoBuf.begin(), (int)fifoBuf.used());
+	if (ret > 0) fifoBuf.drain(ret);
+	return ret;
+}
+
+template<class Mutex>
+inline ssize_t ServerSocket::receiveAll(BasicFIFOBuffer<char, Mutex>& fifoBuf, bool& drained)
+{
+	ssize_t total = 0;
+	drained = false;
+	while (fifoBuf.available() > 0)
+	{
+		ssize_t rc = receiveBytes(fifoBuf.next(), (int)fifoBuf.available());
+		if (rc > 0)
+		{
+			fifoBuf.advance(rc);
+			total += rc;
+		}
+		else if (rc == 0)
+		{
+			// EOF: 已读到数据时先返回数据, 下一次调用再返回 0
+			return total;
+		}
+		else
+		{
+			drained = true;
+			break;
+		}
+	}
+	return total > 0 ? total : -1;
+}
+
+template<class Mutex>
+inline ssize_t ServerSocket::sendAll(BasicFIFOBuffer<char, Mutex>& fifoBuf, bool& drained)
+{
+	ssize_t total = 0;
+	while (!fifoBuf.isEmpty())
+	{
+		if (_sockfd == INVALID_SOCKET) throw std::runtime_error("invalid socket");
+		ssize_t rc = ::send(_sockfd, fifoBuf.begin(), fifoBuf.used(), MSG_NOSIGNAL);
+		if (rc > 0)
+		{
+			fifoBuf.drain(rc);
+			total += rc;
+			continue;
+		}
+
+		int err = lastError();
+		if (rc < 0 && err == EINTR) continue;
+		if (rc < 0 && (err == EAGAIN || err == EWOULDBLOCK)) break;
+		error(err);
+	}
+	drained = fifoBuf.isEmpty();
+	return total;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include "server_socket.h"
+#include "socket_reactor_pool.h"
+#include "socket_acceptor.h"
+
+/// SO_REUSEPORT 分片监听: SocketReactorPool 中每个 Reactor 各自拥有一个监听同一端口的 socket,
+/// 由内核在这些 socket 之间分配新连接, 不再共享一个 accept 队列.
+///
+/// steerByCpu 为 true 时在分组上挂载 classic BPF 程序, 按处理数据包的 CPU 选择绑定在该 CPU 上的
+/// Reactor 的监听 socket. CPU 到下标的映射取自 SocketReactorPool::threadCpu(), 因此线程绑定
+/// (setThreadAffinity(true), setCpus()) 需在构造之前设置; 没有绑定时不挂载, 由内核按哈希分配.
+template<class ServiceHandler>
+class ShardedSocketAcceptor
+{
+public:
+	typedef SocketAcceptor<ServiceHandler> Acceptor;
+
+	ShardedSocketAcceptor(uint16_t port, SocketReactorPool& pool, bool steerByCpu = false, int backlog = 64)
+	{
+		std::vector<std::unique_ptr<ServerSocket>> listeners;
+		listeners.reserve(pool.size());
+		_acceptors.reserve(pool.size());
+
+		// 按 reactor 顺序加入 reuseport 分组, 分组内的下标即 reactor 下标
+		for (std::size_t i = 0; i < pool.size(); ++i)
+		{
+			auto pListener = std::make_unique<ServerSocket>();
+			pListener->bind(port, true, true);
+			pListener->setBlocking(false);
+			if (!pListener->listen(backlog)) ServerSocket::error(port);
+			listeners.push_back(std::move(pListener));
+		}
+
+		if (steerByCpu)
+		{
+			std::vector<int> cpus(listeners.size());
+			for (std::size_t i = 0; i < cpus.size(); ++i)
+			{
+				cpus[i] = pool.threadCpu(i);
+			}
+			if (std::any_of(cpus.begin(), cpus.end(), [](int cpu)
+			{ return cpu >= 0; }))
+			{
+				listeners.front()->attachReusePortCpuFilter(cpus);
+			}
+		}
+
+		// 接受器保存的副本负责关闭监听 socket, 这里只放弃所有权
+		for (std::size_t i = 0; i < listeners.size(); ++i)
+		{
+			_acceptors.push_back(std::make_unique<Acceptor>(*listeners[i], pool.reactor(i)));
+			listeners[i]->release();
+		}
+	}
+
+	virtual ~ShardedSocketAcceptor() = default;
+
+	std::size_t size() const
+	{
+		return _acceptors.size();
+	}
+
+private:
+	std::vector<std::unique_ptr<Acceptor>> _acceptors;
+};
@@ -0,0 +1,100 @@
+
+#include "slab_allocator.h"
+
+SlabAllocator::SlabAllocator()
+{
+	// 池本身很小, slab 在第一次分配时才申请
+	for (std::size_t i = 0; i < CLASS_COUNT; ++i)
+	{
+		_pools[i] = std::make_unique<SlabPool>((i + 1) * GRANULARITY);
+	}
+}
+
+SlabAllocator::~SlabAllocator() = default;
+
+void* SlabAllocator::allocate(std::size_t size)
+{
+	if (size == 0 || size > MAX_SIZE) return ::operator new(size);
+	return _pools[sizeClass(size)]->allocate();
+}
+
+void SlabAllocator::deallocate(void* p, std::size_t size)
+{
+	if (!p) return;
+	if (size == 0 || size > MAX_SIZE)
+	{
+		::operator delete(p);
+		return;
+	}
+	_pools[sizeClass(size)]->deallocate(p);
+}
+
+std::vector<SlabPool::Statistics> SlabAllocator::statistics() const
+{
+	std::vector<SlabPool::Statistics> result;
+	for (const auto& pPool : _pools)
+	{
+		SlabPool::Statistics stats = pPool->statistics();
+		if (stats.slabs > 0) result.push_back(stats);
+	}
+	return result;
+}
+
+void SlabAllocator::setOwner(std::thread::id owner)
+{
+	for (const auto& pPool : _pools)
+	{
+		pPool->setOwner(owner);
+	}
+}
+
+std::size_t SlabAllocator::sizeClass(std::size_t size)
+{
+	return (size - 1) / GRANULARITY;
+}
+
+SlabBlock::SlabBlock(SlabAllocator& allocator, std::size_t size)
+	: _allocator(allocator), _size(size), _p(allocator.allocate(size))
+{
+}
+
+SlabBlock::~SlabBlock()
+{
+	_allocator.deallocate(_p, _size);
+}
+
+void* SlabAllocated::operator new(std::size_t size, SlabAllocator& allocator)
+{
+	auto* pHeader = static_cast<Header*>(allocator.allocate(sizeof(Header) + size));
+	pHeader->pAllocator = &allocator;
+	pHeader->size = size;
+	return pHeader + 1;
+}
+
+void* SlabAllocated::operator new(std::size_t size)
+{
+	auto* pHeader = static_cast<Header*>(::operator new(sizeof(Header) + size));
+	pHeader->pAllocator = nullptr;
+	pHeader->size = size;
+	return pHeader + 1;
+}
+
+void SlabAllocated::operator delete(void* p, SlabAllocator& allocator)
+{
+	operator delete(p);
+}
+
+void SlabAllocated::operator delete(void* p)
+{
+	if (!p) return;
+
+	Header* pHeader = static_cast<Header*>(p) - 1;
+	if (pHeader->pAllocator)
+	{
+		pHeader->pAllocator->deallocate(pHeader, sizeof(Header) + pHeader->size);
+	}
+	else
+	{
+		::operator delete(pHeader);
+	}
+}
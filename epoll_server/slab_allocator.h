@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "slab_pool.h"
+
+/// 每个 SocketReactor 一个: 按 64 字节分级的 SlabPool. 处理器和它固定大小的附属对象
+/// (FIFO 缓冲区、SocketNotifier、观察者副本和快照) 从所在 Reactor 的分配器中取, 连接建立和关闭不再经过全局堆,
+/// 不同 Reactor 线程之间也不再争用 malloc; Reactor 线程自己的分配和释放不加锁 (见 SlabPool::setOwner()).
+/// 大于 MAX_SIZE 的请求交给全局 operator new
+class SlabAllocator : public boost::noncopyable
+{
+public:
+	enum
+	{
+		GRANULARITY = 64,
+		CLASS_COUNT = 64,
+		MAX_SIZE = GRANULARITY * CLASS_COUNT
+	};
+
+	SlabAllocator();
+	~SlabAllocator();
+
+	void* allocate(std::size_t size);
+
+	/// size 必须与分配时相同
+	void deallocate(void* p, std::size_t size);
+
+	/// 已经分配过 slab 的各级占用情况, 按块大小排列
+	std::vector<SlabPool::Statistics> statistics() const;
+
+	/// 见 SlabPool::setOwner(), 对所有级别生效
+	void setOwner(std::thread::id owner);
+
+private:
+	static std::size_t sizeClass(std::size_t size);
+
+	std::unique_ptr<SlabPool> _pools[CLASS_COUNT];
+};
+
+/// 标准库分配器接口, 例如 std::allocate_shared<T>(SlabStlAllocator<T>(allocator), ...),
+/// 控制块和对象一起放在 slab 中. 分配器为空指针时使用全局堆
+template<class T>
+class SlabStlAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit SlabStlAllocator(SlabAllocator& allocator) noexcept
+		: _pAllocator(&allocator)
+	{
+	}
+
+	explicit SlabStlAllocator(SlabAllocator* pAllocator) noexcept
+		: _pAllocator(pAllocator)
+	{
+	}
+
+	template<class U>
+	SlabStlAllocator(const SlabStlAllocator<U>& other) noexcept
+		: _pAllocator(other.allocator())
+	{
+	}
+
+	T* allocate(std::size_t n)
+	{
+		if (!_pAllocator) return static_cast<T*>(::operator new(n * sizeof(T)));
+		return static_cast<T*>(_pAllocator->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T* p, std::size_t n) noexcept
+	{
+		if (!_pAllocator) ::operator delete(p);
+		else _pAllocator->deallocate(p, n * sizeof(T));
+	}
+
+	SlabAllocator* allocator() const noexcept
+	{
+		return _pAllocator;
+	}
+
+	template<class U>
+	bool operator==(const SlabStlAllocator<U>& other) const noexcept
+	{
+		return _pAllocator == other.allocator();
+	}
+
+	template<class U>
+	bool operator!=(const SlabStlAllocator<U>& other) const noexcept
+	{
+		return _pAllocator != other.allocator();
+	}
+
+private:
+	SlabAllocator* _pAllocator;
+};
+
+/// 从 SlabAllocator 中取一块固定大小的内存, 析构时归还. 用作 FIFOBuffer 的外部存储
+class SlabBlock : public boost::noncopyable
+{
+public:
+	SlabBlock(SlabAllocator& allocator, std::size_t size);
+	~SlabBlock();
+
+	template<class T>
+	T* as() const;
+
+	std::size_t size() const;
+
+private:
+	SlabAllocator& _allocator;
+	std::size_t _size;
+	void* _p;
+};
+
+/// 处理器基类: new (reactor.allocator()) Handler(...) 把对象放进 Reactor 的 slab 中.
+/// 块前面记录来源的分配器, delete 和 SocketReactor::retire() 都会归还到原处;
+/// 不带分配器的 new 仍然使用全局堆
+class SlabAllocated
+{
+public:
+	static void* operator new(std::size_t size, SlabAllocator& allocator);
+
+	static void* operator new(std::size_t size);
+
+	/// 构造函数抛出异常时调用
+	static void operator delete(void* p, SlabAllocator& allocator);
+
+	static void operator delete(void* p);
+
+private:
+	/// 保持 max_align_t 对齐
+	struct alignas(std::max_align_t) Header
+	{
+		SlabAllocator* pAllocator;
+		std::size_t size;
+	};
+};
+
+//
+// inlines
+//
+template<class T>
+inline T* SlabBlock::as() const
+{
+	return static_cast<T*>(_p);
+}
+
+inline std::size_t SlabBlock::size() const
+{
+	return _size;
+}
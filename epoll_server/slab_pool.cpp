@@ -0,0 +1,136 @@
+
+#include "slab_pool.h"
+
+#include <algorithm>
+#include <limits>
+#include <new>
+
+SlabPool::SlabPool(std::size_t blockSize)
+	: _blockSize((std::max(blockSize, sizeof(FreeBlock)) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1)),
+	  _blocksPerSlab(std::max<std::size_t>(1, SLAB_SIZE / _blockSize)),
+	  _pFree(nullptr), _pLocal(nullptr), _localCount(0), _inUse(0), _peak(0)
+{
+}
+
+SlabPool::~SlabPool()
+{
+	for (void* pSlab : _slabs)
+	{
+		::operator delete(pSlab);
+	}
+}
+
+void* SlabPool::allocate()
+{
+	FreeBlock* pBlock;
+	if (isOwner())
+	{
+		if (!_pLocal)
+		{
+			std::lock_guard<Mutex> guard(_mutex);
+
+			if (!_pFree) grow();
+			_pLocal = _pFree;
+			_pFree = nullptr;
+			_localCount = 0;
+		}
+		pBlock = _pLocal;
+		_pLocal = pBlock->pNext;
+		if (_localCount > 0) --_localCount;
+	}
+	else
+	{
+		std::lock_guard<Mutex> guard(_mutex);
+
+		pBlock = pop();
+	}
+
+	std::size_t inUse = _inUse.fetch_add(1, std::memory_order_relaxed) + 1;
+	std::size_t peak = _peak.load(std::memory_order_relaxed);
+	while (inUse > peak && !_peak.compare_exchange_weak(peak, inUse, std::memory_order_relaxed))
+	{
+	}
+	return pBlock;
+}
+
+void SlabPool::deallocate(void* p)
+{
+	if (!p) return;
+
+	auto* pBlock = static_cast<FreeBlock*>(p);
+	_inUse.fetch_sub(1, std::memory_order_relaxed);
+	if (isOwner())
+	{
+		pBlock->pNext = _pLocal;
+		_pLocal = pBlock;
+		// 其它线程分配、所属线程释放的块不能一直留在本地, 攒够一个 slab 就还给共享链表
+		if (++_localCount >= _blocksPerSlab) spill(_localCount);
+		return;
+	}
+
+	std::lock_guard<Mutex> guard(_mutex);
+
+	pBlock->pNext = _pFree;
+	_pFree = pBlock;
+}
+
+void SlabPool::setOwner(std::thread::id owner)
+{
+	spill(std::numeric_limits<std::size_t>::max());
+	_owner.store(owner, std::memory_order_relaxed);
+}
+
+SlabPool::Statistics SlabPool::statistics() const
+{
+	std::lock_guard<Mutex> guard(_mutex);
+
+	Statistics stats;
+	stats.blockSize = _blockSize;
+	stats.slabs = _slabs.size();
+	stats.capacity = _slabs.size() * _blocksPerSlab;
+	stats.inUse = _inUse.load(std::memory_order_relaxed);
+	stats.peak = _peak.load(std::memory_order_relaxed);
+	return stats;
+}
+
+SlabPool::FreeBlock* SlabPool::pop()
+{
+	if (!_pFree) grow();
+
+	FreeBlock* pBlock = _pFree;
+	_pFree = pBlock->pNext;
+	return pBlock;
+}
+
+void SlabPool::spill(std::size_t count)
+{
+	if (!_pLocal || count == 0) return;
+
+	FreeBlock* pHead = _pLocal;
+	FreeBlock* pTail = pHead;
+	while (--count > 0 && pTail->pNext)
+	{
+		pTail = pTail->pNext;
+	}
+	_pLocal = pTail->pNext;
+	_localCount = 0;
+
+	std::lock_guard<Mutex> guard(_mutex);
+
+	pTail->pNext = _pFree;
+	_pFree = pHead;
+}
+
+void SlabPool::grow()
+{
+	char* pSlab = static_cast<char*>(::operator new(_blocksPerSlab * _blockSize));
+	_slabs.push_back(pSlab);
+
+	// 倒序挂入, 使得先分配的块地址较低
+	for (std::size_t i = _blocksPerSlab; i-- > 0;)
+	{
+		auto* pBlock = reinterpret_cast<FreeBlock*>(pSlab + i * _blockSize);
+		pBlock->pNext = _pFree;
+		_pFree = pBlock;
+	}
+}
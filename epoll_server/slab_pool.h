@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "threading.h"
+
+/// 固定大小块的 slab 池: 每次向系统申请一整块 slab 切成等大的块, 释放的块挂在空闲链表上复用.
+/// slab 在池析构之前不归还, 稳定状态下分配和释放都不调用全局 operator new/delete.
+/// 所属线程 (setOwner()) 使用自己的空闲链表, 不加锁; 其它线程使用加锁的共享链表.
+/// 所属线程的链表为空时整体取走共享链表, 在其中释放的块每攒够一个 slab 的块数就还给共享链表
+class SlabPool : public boost::noncopyable
+{
+public:
+	typedef DefaultThreadingPolicy::Mutex Mutex;
+
+	/// 占用情况
+	struct Statistics
+	{
+		std::size_t blockSize;
+		std::size_t slabs;
+		std::size_t capacity; // 所有 slab 的块数
+		std::size_t inUse;
+		std::size_t peak;     // inUse 的历史最大值
+	};
+
+	enum
+	{
+		SLAB_SIZE = 64 * 1024
+	};
+
+	/// blockSize 向上取整到指针对齐; 每个 slab 至少容纳一个块
+	explicit SlabPool(std::size_t blockSize);
+	~SlabPool();
+
+	void* allocate();
+
+	void deallocate(void* p);
+
+	/// 之后在 owner 线程中的分配和释放不加锁; 默认的 std::thread::id() 表示没有所属线程.
+	/// 不能与原所属线程的分配和释放并发调用
+	void setOwner(std::thread::id owner);
+
+	Statistics statistics() const;
+
+	std::size_t blockSize() const;
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* pNext;
+	};
+
+	bool isOwner() const;
+
+	/// 以下两个在 _mutex 下调用
+	FreeBlock* pop();
+
+	void grow();
+
+	/// 把所属线程空闲链表开头的 count 个块归还给共享链表.
+	/// 所属线程释放的块总是压在开头, _localCount 就是开头连续的这些块的个数
+	void spill(std::size_t count);
+
+	mutable Mutex _mutex;
+	std::size_t _blockSize;
+	std::size_t _blocksPerSlab;
+	FreeBlock* _pFree;
+	std::vector<void*> _slabs;
+
+	/// 只在所属线程中访问
+	std::atomic<std::thread::id> _owner;
+	FreeBlock* _pLocal;
+	std::size_t _localCount;
+
+	std::atomic<std::size_t> _inUse;
+	std::atomic<std::size_t> _peak;
+};
+
+//
+// inlines
+//
+inline std::size_t SlabPool::blockSize() const
+{
+	return _blockSize;
+}
+
+inline bool SlabPool::isOwner() const
+{
+	return _owner.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
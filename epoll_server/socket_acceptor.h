@@ -1,6 +1,7 @@
 #pragma once
 
-#include <netinet/in.h>
+#include <cstddef>
+#include <type_traits>
 #include "server_socket.h"
 #include "socket_reactor.h"
 #include "observer.h"
@@ -10,17 +11,25 @@ template<class ServiceHandler>
 class SocketAcceptor
 {
 public:
-	using Observer = Observer<SocketAcceptor, ReadableNotification>;
+	using AcceptObserver = Observer<SocketAcceptor, ReadableNotification>;
 
+	enum
+	{
+		DEFAULT_BATCH_SIZE = 64
+	};
+
+	/// 监听 socket 被设置为非阻塞, 每次可读时连续 accept 直到队列为空
 	explicit SocketAcceptor(ServerSocket& socket)
-		: _socket(socket), _pReactor(nullptr)
+		: _socket(socket), _pReactor(nullptr), _batchSize(DEFAULT_BATCH_SIZE)
 	{
+		_socket.setBlocking(false);
 	}
 
 	explicit SocketAcceptor(ServerSocket& socket, SocketReactor& reactor)
-		: _socket(socket), _pReactor(&reactor)
+		: _socket(socket), _pReactor(&reactor), _batchSize(DEFAULT_BATCH_SIZE)
 	{
-		_pReactor->addEventHandler(_socket, Observer(*this, &SocketAcceptor::onAccept));
+		_socket.setBlocking(false);
+		_pReactor->addEventHandler(_socket, AcceptObserver(*this, &SocketAcceptor::onAccept));
 	}
 
 	virtual ~SocketAcceptor()
@@ -29,7 +38,7 @@ public:
 		{
 			if (_pReactor)
 			{
-				_pReactor->removeEventHandler(_socket, Observer(*this, &SocketAcceptor::onAccept));
+				_pReactor->removeEventHandler(_socket, AcceptObserver(*this, &SocketAcceptor::onAccept));
 			}
 		}
 		catch (...)
@@ -45,9 +54,9 @@ public:
 	virtual void registerAcceptor(SocketReactor& reactor)
 	{
 		_pReactor = &reactor;
-		if (!_pReactor->hasEventHandler(_socket, Observer(*this, &SocketAcceptor::onAccept)))
+		if (!_pReactor->hasEventHandler(_socket, AcceptObserver(*this, &SocketAcceptor::onAccept)))
 		{
-			_pReactor->addEventHandler(_socket, Observer(*this, &SocketAcceptor::onAccept));
+			_pReactor->addEventHandler(_socket, AcceptObserver(*this, &SocketAcceptor::onAccept));
 		}
 	}
 
@@ -55,22 +64,44 @@ public:
 	{
 		if (_pReactor)
 		{
-			_pReactor->removeEventHandler(_socket, Observer(*this, &SocketAcceptor::onAccept));
+			_pReactor->removeEventHandler(_socket, AcceptObserver(*this, &SocketAcceptor::onAccept));
 		}
 	}
 
+	/// 每次可读事件最多 accept 的连接数, 剩下的留给下一轮, 避免连接风暴时饿死其它 socket
+	void setBatchSize(std::size_t size)
+	{
+		_batchSize = size > 0 ? size : 1;
+	}
+
+	std::size_t getBatchSize() const
+	{
+		return _batchSize;
+	}
+
 	void onAccept(ReadableNotification* pNotification)
 	{
-		struct sockaddr_in clientAddr{};
-		auto sock = _socket.acceptConnection(clientAddr);
-		_pReactor->wakeUp();
-		createServiceHandler(reinterpret_cast<ServerSocket&>(*sock.get()));
+		for (std::size_t i = 0; i < _batchSize; ++i)
+		{
+			int sockfd = _socket.acceptNonBlocking();
+			if (sockfd < 0) break;
+
+			// 处理器复制 socket 并负责关闭, 这里只放弃所有权
+			ServerSocket socket(sockfd);
+			_pReactor->prepareSocket(socket);
+			createServiceHandler(socket);
+			socket.release();
+		}
 	}
 
 protected:
+	/// 继承 SlabAllocated 的处理器放在 Reactor 的 slab 中
 	virtual ServiceHandler* createServiceHandler(ServerSocket& socket)
 	{
-		return new ServiceHandler(socket, *_pReactor);
+		if constexpr (std::is_base_of_v<SlabAllocated, ServiceHandler>)
+			return new (_pReactor->allocator()) ServiceHandler(socket, *_pReactor);
+		else
+			return new ServiceHandler(socket, *_pReactor);
 	}
 
 	SocketReactor* reactor()
@@ -86,4 +117,5 @@ protected:
 private:
 	ServerSocket _socket;
 	SocketReactor* _pReactor;
+	std::size_t _batchSize;
 };
@@ -0,0 +1,191 @@
+
+#include "socket_connection.h"
+#include "observer.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <sys/socket.h>
+
+SocketConnection::ReadAwaiter::ReadAwaiter(SocketConnection& connection, char* pBuffer, std::size_t length, FIFOBuffer* pFifo)
+	: _connection(connection), _pBuffer(pBuffer), _length(length), _pFifo(pFifo), _result(0)
+{
+}
+
+bool SocketConnection::ReadAwaiter::await_ready()
+{
+	return tryRead();
+}
+
+void SocketConnection::ReadAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	if (_connection._pReader) throw std::logic_error("connection already has a pending read");
+
+	_handle = handle;
+	_connection._pReader = this;
+	_connection._registration.enableRead();
+}
+
+ssize_t SocketConnection::ReadAwaiter::await_resume()
+{
+	if (_pError) std::rethrow_exception(_pError);
+	return _result;
+}
+
+bool SocketConnection::ReadAwaiter::tryRead()
+{
+	ServerSocket& socket = _connection.socket();
+	if (_pFifo)
+	{
+		// 缓冲区满时 recv 长度为 0, 会被误认为对端关闭
+		if (_pFifo->available() == 0) throw std::length_error("fifo buffer is full");
+		_result = socket.receiveBytes(*_pFifo);
+	}
+	else
+	{
+		_result = socket.receiveBytes(_pBuffer, (int)_length);
+	}
+
+	// 非阻塞 socket 在 EAGAIN 时返回 -1
+	return _result != -1;
+}
+
+SocketConnection::WriteAwaiter::WriteAwaiter(SocketConnection& connection, const char* pBuffer, std::size_t length, FIFOBuffer* pFifo)
+	: _connection(connection), _pBuffer(pBuffer), _length(length), _pFifo(pFifo), _written(0)
+{
+}
+
+bool SocketConnection::WriteAwaiter::await_ready()
+{
+	return tryWrite();
+}
+
+void SocketConnection::WriteAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	if (_connection._pWriter) throw std::logic_error("connection already has a pending write");
+
+	_handle = handle;
+	_connection._pWriter = this;
+	_connection._registration.enableWrite();
+}
+
+ssize_t SocketConnection::WriteAwaiter::await_resume()
+{
+	if (_pError) std::rethrow_exception(_pError);
+	return _written;
+}
+
+bool SocketConnection::WriteAwaiter::tryWrite()
+{
+	ServerSocket& socket = _connection.socket();
+	if (_pFifo)
+	{
+		bool drained;
+		_written += socket.sendAll(*_pFifo, drained);
+		return drained;
+	}
+
+	while ((std::size_t)_written < _length)
+	{
+		ssize_t rc = ::send(socket.sockfd(), _pBuffer + _written, _length - _written, MSG_NOSIGNAL);
+		if (rc > 0)
+		{
+			_written += rc;
+			continue;
+		}
+
+		int err = ServerSocket::lastError();
+		if (rc < 0 && err == EINTR) continue;
+		if (rc < 0 && (err == EAGAIN || err == EWOULDBLOCK)) return false;
+		ServerSocket::error(err);
+	}
+	return true;
+}
+
+SocketConnection::SocketConnection(int sockfd, SocketReactor& reactor)
+	: _socket(sockfd), _reactor(reactor), _registration(reactor, _socket, 0), _pReader(nullptr), _pWriter(nullptr)
+{
+	_socket.setBlocking(false);
+
+	_reactor.addEventHandler(_socket,
+		NObserver<SocketConnection, ReadableNotification>(*this, &SocketConnection::onReadable));
+	_reactor.addEventHandler(_socket,
+		NObserver<SocketConnection, WritableNotification>(*this, &SocketConnection::onWritable));
+	_reactor.addEventHandler(_socket,
+		NObserver<SocketConnection, ShutdownNotification>(*this, &SocketConnection::onShutdown));
+}
+
+SocketConnection::~SocketConnection()
+{
+	try
+	{
+		_reactor.removeEventHandler(_socket,
+			NObserver<SocketConnection, ReadableNotification>(*this, &SocketConnection::onReadable));
+		_reactor.removeEventHandler(_socket,
+			NObserver<SocketConnection, WritableNotification>(*this, &SocketConnection::onWritable));
+		_reactor.removeEventHandler(_socket,
+			NObserver<SocketConnection, ShutdownNotification>(*this, &SocketConnection::onShutdown));
+	}
+	catch (...)
+	{
+	}
+}
+
+void SocketConnection::onReadable(const std::shared_ptr<ReadableNotification>& pNf)
+{
+	ReadAwaiter* pReader = _pReader;
+	if (!pReader) return;
+
+	try
+	{
+		if (!pReader->tryRead()) return;
+	}
+	catch (...)
+	{
+		pReader->_pError = std::current_exception();
+	}
+
+	// 协程恢复后可能销毁本对象, 之后不能再访问成员
+	_pReader = nullptr;
+	_registration.disableRead();
+	pReader->_handle.resume();
+}
+
+void SocketConnection::onWritable(const std::shared_ptr<WritableNotification>& pNf)
+{
+	WriteAwaiter* pWriter = _pWriter;
+	if (!pWriter) return;
+
+	try
+	{
+		if (!pWriter->tryWrite()) return;
+	}
+	catch (...)
+	{
+		pWriter->_pError = std::current_exception();
+	}
+
+	_pWriter = nullptr;
+	_registration.disableWrite();
+	pWriter->_handle.resume();
+}
+
+void SocketConnection::onShutdown(const std::shared_ptr<ShutdownNotification>& pNf)
+{
+	ReadAwaiter* pReader = _pReader;
+	WriteAwaiter* pWriter = _pWriter;
+	_pReader = nullptr;
+	_pWriter = nullptr;
+
+	// 以异常恢复挂起的协程, 让它们展开并释放帧
+	auto pError = std::make_exception_ptr(std::runtime_error("reactor shutdown"));
+	if (pReader)
+	{
+		pReader->_pError = pError;
+		pReader->_handle.resume();
+	}
+	if (pWriter)
+	{
+		pWriter->_pError = pError;
+		pWriter->_handle.resume();
+	}
+}
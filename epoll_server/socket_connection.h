@@ -0,0 +1,137 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <boost/noncopyable.hpp>
+
+#include "server_socket.h"
+#include "socket_reactor.h"
+#include "socket_registration.h"
+#include "socket_notification.h"
+#include "fifo_buffer.h"
+
+/// 协程使用的连接: 观察者在构造时注册一次, 等待读写时只通过 SocketRegistration 开关事件.
+/// 先尝试直接读写, 只有 EAGAIN 时才挂起; 就绪后在 Reactor 线程中完成 I/O 再恢复协程.
+/// Reactor 关闭时挂起的协程以异常恢复. 与 SocketRegistration 一样只能用于不带工作线程/leader-followers 的 Reactor
+class SocketConnection : public boost::noncopyable
+{
+public:
+	class ReadAwaiter
+	{
+	public:
+		ReadAwaiter(SocketConnection& connection, char* pBuffer, std::size_t length, FIFOBuffer* pFifo);
+
+		bool await_ready();
+
+		void await_suspend(std::coroutine_handle<> handle);
+
+		/// 读到的字节数, 0 表示对端关闭
+		ssize_t await_resume();
+
+	private:
+		/// 返回 false 表示仍需等待
+		bool tryRead();
+
+		friend class SocketConnection;
+
+		SocketConnection& _connection;
+		char* _pBuffer;
+		std::size_t _length;
+		FIFOBuffer* _pFifo;
+		ssize_t _result;
+		std::exception_ptr _pError;
+		std::coroutine_handle<> _handle;
+	};
+
+	class WriteAwaiter
+	{
+	public:
+		WriteAwaiter(SocketConnection& connection, const char* pBuffer, std::size_t length, FIFOBuffer* pFifo);
+
+		bool await_ready();
+
+		void await_suspend(std::coroutine_handle<> handle);
+
+		/// 写出的字节数
+		ssize_t await_resume();
+
+	private:
+		/// 返回 false 表示仍需等待
+		bool tryWrite();
+
+		friend class SocketConnection;
+
+		SocketConnection& _connection;
+		const char* _pBuffer;
+		std::size_t _length;
+		FIFOBuffer* _pFifo;
+		ssize_t _written;
+		std::exception_ptr _pError;
+		std::coroutine_handle<> _handle;
+	};
+
+	/// 取得 sockfd 的所有权, 析构时关闭; socket 被设置为非阻塞
+	SocketConnection(int sockfd, SocketReactor& reactor);
+	~SocketConnection();
+
+	/// co_await conn.read(fifo): 读到 fifo 的空闲空间中
+	ReadAwaiter read(FIFOBuffer& fifo);
+
+	ReadAwaiter read(void* buffer, std::size_t length);
+
+	/// co_await conn.writeAll(fifo): 写到 fifo 为空为止
+	WriteAwaiter writeAll(FIFOBuffer& fifo);
+
+	WriteAwaiter writeAll(const void* buffer, std::size_t length);
+
+	ServerSocket& socket();
+
+	SocketReactor& reactor();
+
+private:
+	void onReadable(const std::shared_ptr<ReadableNotification>& pNf);
+
+	void onWritable(const std::shared_ptr<WritableNotification>& pNf);
+
+	void onShutdown(const std::shared_ptr<ShutdownNotification>& pNf);
+
+	ServerSocket _socket;
+	SocketReactor& _reactor;
+	SocketRegistration _registration;
+	ReadAwaiter* _pReader;
+	WriteAwaiter* _pWriter;
+};
+
+//
+// inlines
+//
+inline SocketConnection::ReadAwaiter SocketConnection::read(FIFOBuffer& fifo)
+{
+	return { *this, nullptr, 0, &fifo };
+}
+
+inline SocketConnection::ReadAwaiter SocketConnection::read(void* buffer, std::size_t length)
+{
+	return { *this, static_cast<char*>(buffer), length, nullptr };
+}
+
+inline SocketConnection::WriteAwaiter SocketConnection::writeAll(FIFOBuffer& fifo)
+{
+	return { *this, nullptr, 0, &fifo };
+}
+
+inline SocketConnection::WriteAwaiter SocketConnection::writeAll(const void* buffer, std::size_t length)
+{
+	return { *this, static_cast<const char*>(buffer), length, nullptr };
+}
+
+inline ServerSocket& SocketConnection::socket()
+{
+	return _socket;
+}
+
+inline SocketReactor& SocketConnection::reactor()
+{
+	return _reactor;
+}
@@ -1,41 +1,52 @@
 #include "socket_notification.h"
 
-SocketNotification::SocketNotification(SocketReactor* pReactor)
-	: _pReactor(pReactor)
+SocketNotification::SocketNotification(SocketReactor* pReactor, Kind kind)
+	: Notification(kind), _pReactor(pReactor)
 {
 }
 
+SocketNotification::~SocketNotification()
+{
+	// 与 SocketNotifier 一样不拥有 fd
+	_socket.release();
+}
+
 void SocketNotification::setSocket(const ServerSocket& socket)
 {
 	_socket = socket;
 }
 
 ReadableNotification::ReadableNotification(SocketReactor* pReactor)
-	: SocketNotification(pReactor)
+	: SocketNotification(pReactor, READABLE)
 {
 }
 
 WritableNotification::WritableNotification(SocketReactor* pReactor)
-	: SocketNotification(pReactor)
+	: SocketNotification(pReactor, WRITABLE)
 {
 }
 
 ErrorNotification::ErrorNotification(SocketReactor* pReactor)
-	: SocketNotification(pReactor)
+	: SocketNotification(pReactor, ERROR)
+{
+}
+
+ReadTimeoutNotification::ReadTimeoutNotification(SocketReactor* pReactor)
+	: SocketNotification(pReactor, READ_TIMEOUT)
 {
 }
 
 TimeoutNotification::TimeoutNotification(SocketReactor* pReactor)
-	: SocketNotification(pReactor)
+	: SocketNotification(pReactor, TIMEOUT)
 {
 }
 
 IdleNotification::IdleNotification(SocketReactor* pReactor)
-	: SocketNotification(pReactor)
+	: SocketNotification(pReactor, IDLE)
 {
 }
 
 ShutdownNotification::ShutdownNotification(SocketReactor* pReactor)
-	: SocketNotification(pReactor)
+	: SocketNotification(pReactor, SHUTDOWN)
 {
 }
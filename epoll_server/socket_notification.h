@@ -8,12 +8,25 @@ class SocketReactor;
 class SocketNotification : public Notification
 {
 public:
-	explicit SocketNotification(SocketReactor* pReactor);
-	~SocketNotification() override = default;
+	/// 各种 socket 通知的编译期 ID, 同时是 SocketNotifier 中掩码的位序号
+	enum Kind
+	{
+		READABLE,
+		WRITABLE,
+		ERROR,
+		READ_TIMEOUT,
+		TIMEOUT,
+		IDLE,
+		SHUTDOWN,
+		KIND_COUNT
+	};
+
+	SocketNotification(SocketReactor* pReactor, Kind kind);
+	~SocketNotification() override;
 
 	SocketReactor& source() const;
 
-	ServerSocket socket() const;
+	const ServerSocket& socket() const;
 
 private:
 	void setSocket(const ServerSocket& socket);
@@ -27,6 +40,8 @@ private:
 class ReadableNotification : public SocketNotification
 {
 public:
+	static constexpr int ID = READABLE;
+
 	explicit ReadableNotification(SocketReactor* pReactor);
 	~ReadableNotification() override = default;
 };
@@ -34,6 +49,8 @@ public:
 class WritableNotification : public SocketNotification
 {
 public:
+	static constexpr int ID = WRITABLE;
+
 	explicit WritableNotification(SocketReactor* pReactor);
 	~WritableNotification() override = default;
 };
@@ -41,13 +58,27 @@ public:
 class ErrorNotification : public SocketNotification
 {
 public:
+	static constexpr int ID = ERROR;
+
 	explicit ErrorNotification(SocketReactor* pReactor);
 	~ErrorNotification() override = default;
 };
 
+/// SocketReactor::setReadTimeout() 设置的读超时到期, 只发给该 socket 的处理器
+class ReadTimeoutNotification : public SocketNotification
+{
+public:
+	static constexpr int ID = READ_TIMEOUT;
+
+	explicit ReadTimeoutNotification(SocketReactor* pReactor);
+	~ReadTimeoutNotification() override = default;
+};
+
 class TimeoutNotification : public SocketNotification
 {
 public:
+	static constexpr int ID = TIMEOUT;
+
 	explicit TimeoutNotification(SocketReactor* pReactor);
 	~TimeoutNotification() override = default;
 };
@@ -55,6 +86,8 @@ public:
 class IdleNotification : public SocketNotification
 {
 public:
+	static constexpr int ID = IDLE;
+
 	explicit IdleNotification(SocketReactor* pReactor);
 	~IdleNotification() override = default;
 };
@@ -62,6 +95,8 @@ public:
 class ShutdownNotification : public SocketNotification
 {
 public:
+	static constexpr int ID = SHUTDOWN;
+
 	explicit ShutdownNotification(SocketReactor* pReactor);
 	~ShutdownNotification() override = default;
 };
@@ -74,7 +109,7 @@ inline SocketReactor& SocketNotification::source() const
 	return *_pReactor;
 }
 
-inline ServerSocket SocketNotification::socket() const
+inline const ServerSocket& SocketNotification::socket() const
 {
 	return _socket;
 }
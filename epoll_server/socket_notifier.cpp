@@ -3,42 +3,68 @@
 #include "socket_reactor.h"
 #include "socket_notification.h"
 
-SocketNotifier::SocketNotifier(const ServerSocket& socket)
-	: _socket(socket)
+SocketNotifier::SocketNotifier(const ServerSocket& socket, SlabAllocator& allocator, EpochReclaimer& reclaimer)
+	: _nc(&reclaimer, &allocator), _socket(socket), _output(allocator)
 {
 }
 
+SocketNotifier::~SocketNotifier()
+{
+	// _socket 只是注册者的副本, fd 由注册者关闭. 这里关闭的话, 延迟释放时 fd 可能已被新连接复用
+	_socket.release();
+}
+
 void SocketNotifier::addObserver(SocketReactor* pReactor, const AbstractObserver& observer)
 {
 	_nc.addObserver(observer);
 
-	std::unique_lock<std::mutex> lock(_mutex);
-	if (observer.accepts(pReactor->_pReadableNotification.get()))
-		_events.insert(pReactor->_pReadableNotification.get());
-	else if (observer.accepts(pReactor->_pWritableNotification.get()))
-		_events.insert(pReactor->_pWritableNotification.get());
-	else if (observer.accepts(pReactor->_pErrorNotification.get()))
-		_events.insert(pReactor->_pErrorNotification.get());
-	else if (observer.accepts(pReactor->_pTimeoutNotification.get()))
-		_events.insert(pReactor->_pTimeoutNotification.get());
+	unsigned bits = eventMask(pReactor, observer);
+	std::unique_lock<DefaultThreadingPolicy::Mutex> lock(_mutex);
+	for (int id = 0; id < SocketNotification::KIND_COUNT; ++id)
+	{
+		if ((bits & (1u << id)) && _counts[id]++ == 0) _mask.fetch_or(1u << id, std::memory_order_release);
+	}
 }
 
 void SocketNotifier::removeObserver(SocketReactor* pReactor, const AbstractObserver& observer)
 {
 	_nc.removeObserver(observer);
 
-	std::unique_lock<std::mutex> lock(_mutex);
-	auto it = _events.end();
-	if (observer.accepts(pReactor->_pReadableNotification.get()))
-		it = _events.find(pReactor->_pReadableNotification.get());
-	else if (observer.accepts(pReactor->_pWritableNotification.get()))
-		it = _events.find(pReactor->_pWritableNotification.get());
-	else if (observer.accepts(pReactor->_pErrorNotification.get()))
-		it = _events.find(pReactor->_pErrorNotification.get());
-	else if (observer.accepts(pReactor->_pTimeoutNotification.get()))
-		it = _events.find(pReactor->_pTimeoutNotification.get());
-	if (it != _events.end())
-		_events.erase(it);
+	unsigned bits = eventMask(pReactor, observer);
+	std::unique_lock<DefaultThreadingPolicy::Mutex> lock(_mutex);
+	for (int id = 0; id < SocketNotification::KIND_COUNT; ++id)
+	{
+		if ((bits & (1u << id)) && _counts[id] > 0 && --_counts[id] == 0)
+		{
+			_mask.fetch_and(~(1u << id), std::memory_order_release);
+		}
+	}
+}
+
+unsigned SocketNotifier::eventMask(SocketReactor* pReactor, const AbstractObserver& observer)
+{
+	int id = observer.notificationId();
+	if (id != Notification::UNKNOWN_ID)
+	{
+		return id >= 0 && id < SocketNotification::KIND_COUNT ? 1u << id : 0;
+	}
+
+	// 没有编译期 ID 的观察者 (例如直接接收 SocketNotification) 只在注册时逐个匹配一次
+	SocketNotification* notifications[] = {
+		pReactor->_pReadableNotification.get(),
+		pReactor->_pWritableNotification.get(),
+		pReactor->_pErrorNotification.get(),
+		pReactor->_pReadTimeoutNotification.get(),
+		pReactor->_pTimeoutNotification.get(),
+		pReactor->_pIdleNotification.get(),
+		pReactor->_pShutdownNotification.get()
+	};
+	unsigned mask = 0;
+	for (auto* pNotification : notifications)
+	{
+		if (observer.accepts(pNotification)) mask |= 1u << pNotification->id();
+	}
+	return mask;
 }
 
 namespace
@@ -52,7 +78,7 @@ void SocketNotifier::dispatch(SocketNotification* pNotification)
 //	pNotification->duplicate();
 	try
 	{
-		_nc.postNotification(Notification::Ptr(pNotification));
+		_nc.postNotification(pNotification);
 	}
 	catch (...)
 	{
@@ -1,22 +1,40 @@
 #pragma once
 
-#include <set>
+#include <array>
 #include <memory>
 #include <mutex>
+#include <cstdint>
+#include <atomic>
 
 #include "server_socket.h"
 #include "notification.h"
 #include "notification_center.h"
+#include "poll_set.h"
+#include "socket_notification.h"
+#include "output_queue.h"
+#include "timing_wheel.h"
 
 class SocketReactor;
 class AbstractObserver;
-class SocketNotification;
+class EpochReclaimer;
 
-class SocketNotifier
+class SocketNotifier : public std::enable_shared_from_this<SocketNotifier>
 {
+	friend class SocketReactor;
+
 public:
-	explicit SocketNotifier(const ServerSocket& socket);
-	~SocketNotifier() = default;
+	/// 派发优先级: 同一轮就绪的 socket 按类别从高到低派发, 例如控制连接总在大流量传输之前
+	enum Priority
+	{
+		PRIORITY_HIGH,
+		PRIORITY_NORMAL,
+		PRIORITY_LOW,
+		PRIORITY_COUNT
+	};
+
+	/// 输出队列的块、观察者副本和快照从 allocator 中分配; 被替换的快照交给 Reactor 的 reclaimer, 在每轮循环结束时回收
+	SocketNotifier(const ServerSocket& socket, SlabAllocator& allocator, EpochReclaimer& reclaimer);
+	~SocketNotifier();
 
 	void addObserver(SocketReactor* pReactor, const AbstractObserver& observer);
 
@@ -24,7 +42,12 @@ public:
 
 	bool hasObserver(const AbstractObserver& observer) const;
 
-	bool accepts(SocketNotification* pNotification);
+	bool accepts(SocketNotification* pNotification) const;
+
+	bool accepts(int id) const;
+
+	/// 已注册观察者的通知掩码, 第 SocketNotification::Kind 位对应一种通知
+	unsigned mask() const;
 
 	void dispatch(SocketNotification* pNotification);
 
@@ -32,22 +55,85 @@ public:
 
 	std::size_t countObservers() const;
 
+	const ServerSocket& socket() const;
+
+	int sockfd() const;
+
+	std::uint32_t generation() const;
+
+	void setGeneration(std::uint32_t generation);
+
+	bool setInFlight(bool flag);
+
+	bool isInFlight() const;
+
+	/// SocketRegistration 打开的读写事件, 与观察者共同决定 epoll 掩码
+	int interest() const;
+
+	void setInterest(int interest);
+
+	/// 设置是否已经在 Reactor 的变更列表中, 返回之前的状态
+	bool setPending(bool flag);
+
+	Priority priority() const;
+
+	void setPriority(Priority priority);
+
+	/// 本轮用完预算、留到下一轮继续的事件: 合并模式, 返回之前的模式 (0 表示还不在 Reactor 的列表中)
+	int carry(int mode);
+
+	/// 取出并清除留下的事件
+	int takeCarry();
+
+	/// SocketReactor::send() 排队、尚未发出的数据
+	OutputQueue& output();
+
 private:
-	typedef std::multiset<SocketNotification*> EventSet;
+	static unsigned eventMask(SocketReactor* pReactor, const AbstractObserver& observer);
 
-	EventSet _events;
+	std::array<std::size_t, SocketNotification::KIND_COUNT> _counts{};
+	std::atomic<unsigned> _mask{ 0 };
 	NotificationCenter _nc;
 	ServerSocket _socket;
-	std::mutex _mutex;
+	std::uint32_t _generation = 0;
+	std::atomic<bool> _inFlight{ false };
+	std::atomic<int> _interest{ PollSet::POLL_READ | PollSet::POLL_WRITE };
+	bool _pending = false;
+	Priority _priority = PRIORITY_NORMAL;
+	int _carry = 0;
+	OutputQueue _output;
+
+	/// SocketReactor::setReadTimeout() 的定时器, 只在 Reactor 线程中操作
+	Timer _readTimer;
+	TimingWheel::Clock::duration _readTimeout{ 0 };
+
+	/// SocketReactor 中 Timeout/Idle/Shutdown 订阅链表的侵入式节点, 由 Reactor 的 _mutex 保护
+	enum
+	{
+		BROADCAST_COUNT = SocketNotification::KIND_COUNT - SocketNotification::TIMEOUT
+	};
+	SocketNotifier* _pPrevSubscriber[BROADCAST_COUNT] = {};
+	SocketNotifier* _pNextSubscriber[BROADCAST_COUNT] = {};
+	unsigned _subscribed = 0;
+	DefaultThreadingPolicy::Mutex _mutex;
 };
 
 //
 // inlines
 //
-inline bool SocketNotifier::accepts(SocketNotification* pNotification)
+inline bool SocketNotifier::accepts(SocketNotification* pNotification) const
 {
-	std::unique_lock<std::mutex> lock(_mutex);
-	return _events.find(pNotification) != _events.end();
+	return accepts(pNotification->id());
+}
+
+inline bool SocketNotifier::accepts(int id) const
+{
+	return id >= 0 && id < SocketNotification::KIND_COUNT && (mask() & (1u << id));
+}
+
+inline unsigned SocketNotifier::mask() const
+{
+	return _mask.load(std::memory_order_acquire);
 }
 
 inline bool SocketNotifier::hasObserver(const AbstractObserver& observer) const
@@ -64,3 +150,80 @@ inline std::size_t SocketNotifier::countObservers() const
 {
 	return _nc.countObservers();
 }
+
+inline const ServerSocket& SocketNotifier::socket() const
+{
+	return _socket;
+}
+
+inline int SocketNotifier::sockfd() const
+{
+	return _socket.sockfd();
+}
+
+inline std::uint32_t SocketNotifier::generation() const
+{
+	return _generation;
+}
+
+inline void SocketNotifier::setGeneration(std::uint32_t generation)
+{
+	_generation = generation;
+}
+
+/// 设置是否正在被工作线程处理, 返回之前的状态
+inline bool SocketNotifier::setInFlight(bool flag)
+{
+	return _inFlight.exchange(flag, std::memory_order_acq_rel);
+}
+
+inline bool SocketNotifier::isInFlight() const
+{
+	return _inFlight.load(std::memory_order_acquire);
+}
+
+inline int SocketNotifier::interest() const
+{
+	return _interest.load(std::memory_order_relaxed);
+}
+
+inline void SocketNotifier::setInterest(int interest)
+{
+	_interest.store(interest, std::memory_order_relaxed);
+}
+
+inline bool SocketNotifier::setPending(bool flag)
+{
+	bool pending = _pending;
+	_pending = flag;
+	return pending;
+}
+
+inline SocketNotifier::Priority SocketNotifier::priority() const
+{
+	return _priority;
+}
+
+inline void SocketNotifier::setPriority(Priority priority)
+{
+	_priority = priority;
+}
+
+inline int SocketNotifier::carry(int mode)
+{
+	int previous = _carry;
+	_carry |= mode;
+	return previous;
+}
+
+inline int SocketNotifier::takeCarry()
+{
+	int mode = _carry;
+	_carry = 0;
+	return mode;
+}
+
+inline OutputQueue& SocketNotifier::output()
+{
+	return _output;
+}
@@ -0,0 +1,104 @@
+
+#include "socket_notifier_table.h"
+#include "socket_notifier.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <sys/resource.h>
+
+SocketNotifierTable::SocketNotifierTable()
+	: _chunkCount(0), _maxFd(-1), _size(0), _active(0)
+{
+	// 按进程允许的最大 fd 数预留块目录, 之后目录本身不再扩容
+	std::size_t maxFds = MAX_FDS;
+	struct rlimit rl{};
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_max != RLIM_INFINITY)
+	{
+		maxFds = std::min<std::size_t>(rl.rlim_max, MAX_FDS);
+	}
+
+	_chunkCount = (maxFds + CHUNK_SIZE - 1) >> CHUNK_BITS;
+	_chunks.reset(new std::atomic<Slot*>[_chunkCount]);
+	for (std::size_t i = 0; i < _chunkCount; ++i)
+	{
+		_chunks[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+SocketNotifierTable::~SocketNotifierTable()
+{
+	for (std::size_t i = 0; i < _chunkCount; ++i)
+	{
+		delete[] _chunks[i].load(std::memory_order_relaxed);
+	}
+}
+
+SocketNotifierTable::NotifierPtr SocketNotifierTable::find(int fd) const
+{
+	Slot* pSlot = slot(fd);
+	return pSlot ? pSlot->pNotifier : nullptr;
+}
+
+void SocketNotifierTable::insert(int fd, const NotifierPtr& pNotifier)
+{
+	Slot& s = makeSlot(fd);
+	if (!s.pNotifier) _size.fetch_add(1, std::memory_order_relaxed);
+
+	s.pNotifier = pNotifier;
+	pNotifier->setGeneration(s.generation.load(std::memory_order_relaxed));
+
+	if (fd > _maxFd) _maxFd = fd;
+}
+
+SocketNotifierTable::NotifierPtr SocketNotifierTable::erase(int fd)
+{
+	Slot* pSlot = slot(fd);
+	if (!pSlot || !pSlot->pNotifier) return nullptr;
+
+	setMode(fd, 0);
+	pSlot->generation.fetch_add(1, std::memory_order_release);
+	_size.fetch_sub(1, std::memory_order_relaxed);
+
+	NotifierPtr pNotifier;
+	pNotifier.swap(pSlot->pNotifier);
+	return pNotifier;
+}
+
+void SocketNotifierTable::setMode(int fd, int mode)
+{
+	Slot* pSlot = slot(fd);
+	if (!pSlot || pSlot->mode == mode) return;
+
+	if (pSlot->mode == 0) _active.fetch_add(1, std::memory_order_relaxed);
+	else if (mode == 0) _active.fetch_sub(1, std::memory_order_relaxed);
+	pSlot->mode = mode;
+}
+
+int SocketNotifierTable::mode(int fd) const
+{
+	Slot* pSlot = slot(fd);
+	return pSlot ? pSlot->mode : 0;
+}
+
+bool SocketNotifierTable::isCurrent(const SocketNotifier* pNotifier) const
+{
+	Slot* pSlot = slot(pNotifier->sockfd());
+	return pSlot && pSlot->generation.load(std::memory_order_acquire) == pNotifier->generation();
+}
+
+SocketNotifierTable::Slot& SocketNotifierTable::makeSlot(int fd)
+{
+	std::size_t index = (std::size_t)fd >> CHUNK_BITS;
+	if (fd < 0 || index >= _chunkCount)
+	{
+		throw std::out_of_range("socket descriptor out of range: " + std::to_string(fd));
+	}
+
+	Slot* pChunk = _chunks[index].load(std::memory_order_acquire);
+	if (!pChunk)
+	{
+		pChunk = new Slot[CHUNK_SIZE];
+		_chunks[index].store(pChunk, std::memory_order_release);
+	}
+	return pChunk[fd & CHUNK_MASK];
+}
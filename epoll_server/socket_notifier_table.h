@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <boost/noncopyable.hpp>
+
+class SocketNotifier;
+
+/// 以 fd 为下标的 SocketNotifier 表.
+/// 按块分配, 块一旦分配在表析构前不会释放, 因此 isCurrent() 和 activeCount() 可以无锁读取;
+/// 其余修改和查找操作由调用者 (SocketReactor) 加锁.
+class SocketNotifierTable : public boost::noncopyable
+{
+public:
+	typedef std::shared_ptr<SocketNotifier> NotifierPtr;
+
+	SocketNotifierTable();
+	~SocketNotifierTable();
+
+	NotifierPtr find(int fd) const;
+
+	void insert(int fd, const NotifierPtr& pNotifier);
+
+	NotifierPtr erase(int fd);
+
+	void setMode(int fd, int mode);
+
+	int mode(int fd) const;
+
+	bool isCurrent(const SocketNotifier* pNotifier) const;
+
+	std::size_t size() const;
+
+	std::size_t activeCount() const;
+
+	template<class Fn>
+	void forEach(Fn&& fn) const;
+
+private:
+	enum
+	{
+		CHUNK_BITS = 10,
+		CHUNK_SIZE = 1 << CHUNK_BITS,
+		CHUNK_MASK = CHUNK_SIZE - 1,
+		MAX_FDS = 1 << 24
+	};
+
+	struct Slot
+	{
+		NotifierPtr pNotifier;
+		std::atomic<std::uint32_t> generation{ 0 };
+		int mode = 0;
+	};
+
+	Slot* slot(int fd) const;
+
+	Slot& makeSlot(int fd);
+
+	std::size_t _chunkCount;
+	std::unique_ptr<std::atomic<Slot*>[]> _chunks;
+
+	int _maxFd;
+	std::atomic<std::size_t> _size;
+	std::atomic<std::size_t> _active;
+};
+
+//
+// inlines
+//
+inline SocketNotifierTable::Slot* SocketNotifierTable::slot(int fd) const
+{
+	std::size_t index = (std::size_t)fd >> CHUNK_BITS;
+	if (fd < 0 || index >= _chunkCount) return nullptr;
+
+	Slot* pChunk = _chunks[index].load(std::memory_order_acquire);
+	return pChunk ? &pChunk[fd & CHUNK_MASK] : nullptr;
+}
+
+inline std::size_t SocketNotifierTable::size() const
+{
+	return _size.load(std::memory_order_relaxed);
+}
+
+inline std::size_t SocketNotifierTable::activeCount() const
+{
+	return _active.load(std::memory_order_relaxed);
+}
+
+template<class Fn>
+void SocketNotifierTable::forEach(Fn&& fn) const
+{
+	for (int fd = 0; fd <= _maxFd; ++fd)
+	{
+		Slot* pSlot = slot(fd);
+		if (pSlot && pSlot->pNotifier) fn(pSlot->pNotifier);
+	}
+}
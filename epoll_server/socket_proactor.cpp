@@ -0,0 +1,525 @@
+
+#include "socket_proactor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+SocketProactor::Operation::Operation(int fd, uint32_t generation)
+	: fd(fd), generation(generation), pPrev(nullptr), pNext(nullptr)
+{
+}
+
+class SocketProactor::AcceptOperation : public SocketProactor::Operation
+{
+public:
+	AcceptOperation(int fd, uint32_t generation, AcceptHandler handler)
+		: Operation(fd, generation), handler(std::move(handler))
+	{
+	}
+
+	bool complete(SocketProactor& proactor, const io_uring_cqe& cqe) override
+	{
+		if (cqe.res != -ECANCELED && handler) handler(cqe.res);
+		if (cqe.flags & IORING_CQE_F_MORE) return false;
+
+		// multishot 被内核终止 (例如 EMFILE): 除了取消和监听 socket 失效之外重新提交
+		if (cqe.res == -ECANCELED || cqe.res == -EBADF || cqe.res == -EINVAL) return true;
+		if (!proactor.isCurrent(*this)) return true;
+		proactor.submitAccept(this);
+		return false;
+	}
+
+	AcceptHandler handler;
+};
+
+class SocketProactor::ReceiveOperation : public SocketProactor::Operation
+{
+public:
+	ReceiveOperation(int fd, uint32_t generation, ReceiveHandler handler)
+		: Operation(fd, generation), handler(std::move(handler))
+	{
+	}
+
+	bool complete(SocketProactor& proactor, const io_uring_cqe& cqe) override
+	{
+		// 缓冲区由 processCompletions() 在回调之后归还
+		bool more = cqe.flags & IORING_CQE_F_MORE;
+		if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+		{
+			unsigned id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+			handler(Buffer(proactor.buffer(id), cqe.res), 0);
+		}
+		else if (cqe.res != -ENOBUFS)
+		{
+			// 对端关闭 (0) 或出错, 之后不会再有完成事件
+			handler(Buffer(), -cqe.res);
+			return !more;
+		}
+
+		if (more) return false;
+		if (!proactor.isCurrent(*this)) return true;
+
+		// buffer ring 暂时耗尽 (ENOBUFS) 时等到有缓冲区归还再重新提交, 其它原因终止的 multishot 直接重新提交
+		if (cqe.res == -ENOBUFS) proactor.starve(this);
+		else proactor.submitReceive(this);
+		return false;
+	}
+
+	ReceiveHandler handler;
+};
+
+class SocketProactor::SendOperation : public SocketProactor::Operation
+{
+public:
+	SendOperation(int fd, const void* buffer, std::size_t length, SendHandler handler, uint32_t generation)
+		: Operation(fd, generation), data(static_cast<const char*>(buffer), static_cast<const char*>(buffer) + length),
+		  handler(std::move(handler))
+	{
+	}
+
+	bool complete(SocketProactor& proactor, const io_uring_cqe& cqe) override
+	{
+		proactor.completeSend(this);
+		if (handler) handler(cqe.res);
+		return true;
+	}
+
+	std::vector<char> data;
+	SendHandler handler;
+};
+
+SocketProactor::SocketProactor(std::size_t bufferCount, std::size_t bufferSize)
+	: _pRing(std::make_unique<IoUring>()), _stop(false), _timeout(std::chrono::microseconds(DEFAULT_TIMEOUT)),
+	  _eventfd(-1), _bufferCount(bufferCount), _bufferSize(bufferSize), _pBufferRing(nullptr), _bufferRingSize(0),
+	  _bufferTail(0), _pOperations(nullptr), _operationCount(0), _sleeping(false)
+{
+	if (bufferCount == 0 || bufferCount > 32768 || (bufferCount & (bufferCount - 1)))
+	{
+		throw std::invalid_argument("buffer count must be a power of two not greater than 32768");
+	}
+
+	_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventfd < 0) ServerSocket::error();
+
+	try
+	{
+		createBufferRing();
+	}
+	catch (...)
+	{
+		::close(_eventfd);
+		throw;
+	}
+	armWakeUp();
+}
+
+SocketProactor::~SocketProactor()
+{
+	// 关闭 io_uring 会取消所有未完成的操作, 之后才能释放它们引用的内存
+	_pRing.reset();
+
+	while (_pOperations)
+	{
+		Operation* pOperation = _pOperations;
+		_pOperations = pOperation->pNext;
+		delete pOperation;
+	}
+	for (auto& descriptor : _descriptors)
+	{
+		for (auto pOperation : descriptor.pending)
+		{
+			delete pOperation;
+		}
+	}
+
+	destroyBufferRing();
+	::close(_eventfd);
+}
+
+bool SocketProactor::supported()
+{
+	if (!IoUring::supported()) return false;
+
+	try
+	{
+		SocketProactor proactor(1, 64);
+		return true;
+	}
+	catch (std::exception&)
+	{
+		return false;
+	}
+}
+
+void SocketProactor::run()
+{
+	while (!_stop)
+	{
+		try
+		{
+			runTasks();
+			flushSends();
+			wait();
+			processCompletions();
+		}
+		catch (std::exception& exc)
+		{
+		}
+		catch (...)
+		{
+		}
+	}
+}
+
+void SocketProactor::stop()
+{
+	_stop = true;
+	wakeUp();
+}
+
+void SocketProactor::wakeUp()
+{
+	uint64_t val = 1;
+	ssize_t n = ::write(_eventfd, &val, sizeof(val));
+	(void)n;
+}
+
+void SocketProactor::post(Task task)
+{
+	_tasks.push(std::move(task));
+	wakeUpIfSleeping();
+}
+
+void SocketProactor::accept(const ServerSocket& socket, AcceptHandler handler)
+{
+	int fd = socket.sockfd();
+	auto pOperation = new AcceptOperation(fd, descriptor(fd).generation, std::move(handler));
+	link(pOperation);
+	submitAccept(pOperation);
+}
+
+void SocketProactor::receive(const ServerSocket& socket, ReceiveHandler handler)
+{
+	int fd = socket.sockfd();
+	auto pOperation = new ReceiveOperation(fd, descriptor(fd).generation, std::move(handler));
+	link(pOperation);
+	submitReceive(pOperation);
+}
+
+void SocketProactor::send(const ServerSocket& socket, const void* buffer, std::size_t length, SendHandler handler)
+{
+	int fd = socket.sockfd();
+	Descriptor& desc = descriptor(fd);
+	desc.pending.push_back(new SendOperation(fd, buffer, length, std::move(handler), desc.generation));
+	markDirty(fd);
+}
+
+void SocketProactor::cancel(const ServerSocket& socket)
+{
+	int fd = socket.sockfd();
+	if (fd < 0) return;
+
+	// 在途的操作仍会完成, 新的 generation 使它们不再回调, 也不再计入这个 fd 之后的发送队列
+	Descriptor& desc = descriptor(fd);
+	for (auto pOperation : desc.pending)
+	{
+		delete pOperation;
+	}
+	desc.pending.clear();
+	desc.inFlight = 0;
+	++desc.generation;
+
+	io_uring_sqe* pSqe = getSqe();
+	pSqe->opcode = IORING_OP_ASYNC_CANCEL;
+	pSqe->fd = fd;
+	pSqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	pSqe->user_data = CANCEL_TAG;
+
+	// 调用方随后可能关闭 fd, 取消必须在 fd 被复用之前到达内核
+	_pRing->submit();
+}
+
+io_uring_sqe* SocketProactor::getSqe()
+{
+	io_uring_sqe* pSqe = _pRing->getSqe();
+	if (!pSqe) ServerSocket::error(EBUSY);
+	return pSqe;
+}
+
+SocketProactor::Descriptor& SocketProactor::descriptor(int fd)
+{
+	if (fd < 0) ServerSocket::error(EBADF);
+	if ((std::size_t)fd >= _descriptors.size()) _descriptors.resize(fd + 1);
+	return _descriptors[fd];
+}
+
+void SocketProactor::link(Operation* pOperation)
+{
+	pOperation->pNext = _pOperations;
+	if (_pOperations) _pOperations->pPrev = pOperation;
+	_pOperations = pOperation;
+	++_operationCount;
+}
+
+void SocketProactor::unlink(Operation* pOperation)
+{
+	if (pOperation->pPrev) pOperation->pPrev->pNext = pOperation->pNext;
+	else _pOperations = pOperation->pNext;
+	if (pOperation->pNext) pOperation->pNext->pPrev = pOperation->pPrev;
+	--_operationCount;
+}
+
+void SocketProactor::submitAccept(AcceptOperation* pOperation)
+{
+	io_uring_sqe* pSqe = getSqe();
+	pSqe->opcode = IORING_OP_ACCEPT;
+	pSqe->fd = pOperation->fd;
+	pSqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	pSqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	pSqe->user_data = reinterpret_cast<uint64_t>(static_cast<Operation*>(pOperation));
+}
+
+void SocketProactor::submitReceive(ReceiveOperation* pOperation)
+{
+	io_uring_sqe* pSqe = getSqe();
+	pSqe->opcode = IORING_OP_RECV;
+	pSqe->fd = pOperation->fd;
+	pSqe->ioprio = IORING_RECV_MULTISHOT;
+	pSqe->flags = IOSQE_BUFFER_SELECT;
+	pSqe->buf_group = BUFFER_GROUP;
+	pSqe->user_data = reinterpret_cast<uint64_t>(static_cast<Operation*>(pOperation));
+}
+
+void SocketProactor::starve(ReceiveOperation* pOperation)
+{
+	_starved.push_back(pOperation);
+}
+
+void SocketProactor::resubmitStarved()
+{
+	// 提交失败 (EBUSY) 时剩下的操作留到下一轮
+	while (!_starved.empty())
+	{
+		ReceiveOperation* pOperation = _starved.back();
+		if (isCurrent(*pOperation))
+		{
+			submitReceive(pOperation);
+		}
+		else
+		{
+			unlink(pOperation);
+			delete pOperation;
+		}
+		_starved.pop_back();
+	}
+}
+
+void SocketProactor::markDirty(int fd)
+{
+	Descriptor& desc = _descriptors[fd];
+	if (desc.dirty) return;
+
+	desc.dirty = true;
+	_dirty.push_back(fd);
+}
+
+void SocketProactor::flushSends()
+{
+	std::size_t flushed = 0;
+	for (; flushed < _dirty.size(); ++flushed)
+	{
+		int fd = _dirty[flushed];
+		Descriptor& desc = _descriptors[fd];
+		if (desc.inFlight || desc.pending.empty())
+		{
+			desc.dirty = false;
+			continue;
+		}
+
+		// 链中的一个发送失败时后续的发送以 -ECANCELED 完成, MSG_WAITALL 使短写也视为失败.
+		// 整条链的 SQE 必须先保证能取得: 中途失败会留下末尾带 IOSQE_IO_LINK 的半条链.
+		// 提交之后仍然放不下时只链接放得下的部分, 一个也放不下就把剩下的 fd 留到下一轮
+		std::size_t count = std::min<std::size_t>(desc.pending.size(), MAX_LINKED_SENDS);
+		if (_pRing->space() < count) _pRing->submit();
+		count = std::min<std::size_t>(count, _pRing->space());
+		if (count == 0) break;
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			SendOperation* pOperation = desc.pending[i];
+			io_uring_sqe* pSqe = getSqe();
+			pSqe->opcode = IORING_OP_SEND;
+			pSqe->fd = fd;
+			pSqe->addr = reinterpret_cast<uint64_t>(pOperation->data.data());
+			pSqe->len = (unsigned)pOperation->data.size();
+			pSqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+			if (i + 1 < count) pSqe->flags = IOSQE_IO_LINK;
+			pSqe->user_data = reinterpret_cast<uint64_t>(static_cast<Operation*>(pOperation));
+			link(pOperation);
+		}
+		desc.pending.erase(desc.pending.begin(), desc.pending.begin() + count);
+		desc.inFlight = count;
+		desc.dirty = false;
+	}
+	_dirty.erase(_dirty.begin(), _dirty.begin() + flushed);
+}
+
+void SocketProactor::completeSend(SendOperation* pOperation)
+{
+	Descriptor& desc = _descriptors[pOperation->fd];
+	if (--desc.inFlight == 0 && !desc.pending.empty()) markDirty(pOperation->fd);
+}
+
+void SocketProactor::recycle(unsigned id)
+{
+	// 不能使用 io_uring_buf_ring::bufs: 在 C++ 中 __DECLARE_FLEX_ARRAY 的空结构体占 1 字节, 数组偏移与内核不一致
+	io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(_pBufferRing)[_bufferTail & (_bufferCount - 1)];
+	buf.addr = reinterpret_cast<uint64_t>(buffer(id));
+	buf.len = (unsigned)_bufferSize;
+	buf.bid = (unsigned short)id;
+	++_bufferTail;
+
+	// 缓冲区描述必须在 tail 之前对内核可见
+	std::atomic_ref<unsigned short>(_pBufferRing->tail).store(_bufferTail, std::memory_order_release);
+}
+
+void SocketProactor::armWakeUp()
+{
+	io_uring_sqe* pSqe = getSqe();
+	pSqe->opcode = IORING_OP_POLL_ADD;
+	pSqe->fd = _eventfd;
+	pSqe->poll32_events = EPOLLIN;
+	pSqe->len = IORING_POLL_ADD_MULTI;
+	pSqe->user_data = WAKEUP_TAG;
+}
+
+void SocketProactor::wakeUpIfSleeping()
+{
+	// 与 wait() 中先置 _sleeping 再检查队列相对应
+	if (_sleeping.load() && _sleeping.exchange(false)) wakeUp();
+}
+
+void SocketProactor::runTasks()
+{
+	Task task;
+	for (int n = 0; n < MAX_TASKS_PER_ITERATION && _tasks.pop(task); ++n)
+	{
+		try
+		{
+			task();
+		}
+		catch (std::exception& exc)
+		{
+		}
+		catch (...)
+		{
+		}
+		task = nullptr;
+	}
+}
+
+void SocketProactor::wait()
+{
+	std::chrono::system_clock::duration timeout = _timeout;
+	if (_pRing->peekCqe()) timeout = std::chrono::system_clock::duration::zero();
+	if (timeout != std::chrono::system_clock::duration::zero())
+	{
+		_sleeping.store(true);
+		if (!_tasks.empty()) timeout = std::chrono::system_clock::duration::zero();
+	}
+
+	// 本轮提交的操作与等待合并为一次 io_uring_enter; 被信号中断时直接进入下一轮
+	_pRing->wait(_pRing->flush(), 1, timeout);
+	_sleeping.store(false, std::memory_order_relaxed);
+}
+
+void SocketProactor::processCompletions()
+{
+	std::size_t starved = _starved.size();
+	bool recycled = false;
+
+	io_uring_cqe* pCqe;
+	while ((pCqe = _pRing->peekCqe()))
+	{
+		// 回调中可能提交新的操作, 先复制并归还完成事件
+		io_uring_cqe cqe = *pCqe;
+		_pRing->advance();
+
+		if (cqe.user_data == CANCEL_TAG) continue;
+		if (cqe.user_data == WAKEUP_TAG)
+		{
+			uint64_t val;
+			ssize_t n = ::read(_eventfd, &val, sizeof(val));
+			(void)n;
+			if (!(cqe.flags & IORING_CQE_F_MORE)) armWakeUp();
+			continue;
+		}
+
+		// cancel() 之后的完成事件只用于释放操作和归还缓冲区
+		auto pOperation = reinterpret_cast<Operation*>(cqe.user_data);
+		bool done = !(cqe.flags & IORING_CQE_F_MORE);
+		try
+		{
+			if (isCurrent(*pOperation)) done = pOperation->complete(*this, cqe);
+		}
+		catch (std::exception& exc)
+		{
+		}
+		catch (...)
+		{
+		}
+		if (cqe.flags & IORING_CQE_F_BUFFER)
+		{
+			recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			recycled = true;
+		}
+		if (done)
+		{
+			unlink(pOperation);
+			delete pOperation;
+		}
+	}
+
+	// 本轮有缓冲区归还, 或者等待过一轮没有新的 ENOBUFS 时才重新提交, 避免缓冲区耗尽时空转
+	if (!_starved.empty() && (recycled || _starved.size() == starved)) resubmitStarved();
+}
+
+void SocketProactor::createBufferRing()
+{
+	_pBuffers = std::make_unique<char[]>(_bufferCount * _bufferSize);
+
+	// buffer ring 必须按页对齐, 由内核与用户态共享
+	_bufferRingSize = _bufferCount * sizeof(io_uring_buf);
+	void* pRing = ::mmap(nullptr, _bufferRingSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (pRing == MAP_FAILED) ServerSocket::error();
+	_pBufferRing = static_cast<io_uring_buf_ring*>(pRing);
+
+	int err = _pRing->registerBufferRing(_pBufferRing, (unsigned)_bufferCount, BUFFER_GROUP);
+	if (err)
+	{
+		destroyBufferRing();
+		ServerSocket::error(-err);
+	}
+
+	for (std::size_t id = 0; id < _bufferCount; ++id)
+	{
+		recycle((unsigned)id);
+	}
+}
+
+void SocketProactor::destroyBufferRing()
+{
+	if (_pRing) _pRing->unregisterBufferRing(BUFFER_GROUP);
+	if (_pBufferRing)
+	{
+		::munmap(_pBufferRing, _bufferRingSize);
+		_pBufferRing = nullptr;
+	}
+}
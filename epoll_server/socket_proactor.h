@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "server_socket.h"
+#include "mpsc_queue.h"
+#include "uring.h"
+
+/// 基于 io_uring 的 Proactor: 提交操作, 在完成时回调.
+/// 与 SocketReactor 不同, 接收不需要先等待可读再调用 recv, 也不需要每个连接常驻一个接收缓冲区:
+/// multishot recv 从所有连接共享的 buffer ring 中由内核挑选缓冲区, 回调处理完之后立即归还.
+/// 同一个连接在一轮循环中的多次 send() 以 IOSQE_IO_LINK 链接后一起提交, 保证顺序.
+/// 除 post()/stop()/wakeUp() 之外, 其它方法只能在 run() 所在的线程 (即回调中) 调用.
+class SocketProactor : public boost::noncopyable
+{
+public:
+	/// 接收到的数据, 只在回调期间有效
+	typedef std::span<const char> Buffer;
+	/// fd 为新连接 (非阻塞, close-on-exec), 由回调负责关闭; 负数为 -errno
+	typedef std::function<void(int fd)> AcceptHandler;
+	/// 对端关闭时 data 为空且 error 为 0; 出错时 data 为空, error 为 errno
+	typedef std::function<void(Buffer data, int error)> ReceiveHandler;
+	/// result 为发送的字节数或 -errno
+	typedef std::function<void(int result)> SendHandler;
+	typedef std::function<void()> Task;
+
+	/// bufferCount 必须是 2 的幂, 不超过 32768
+	explicit SocketProactor(std::size_t bufferCount = DEFAULT_BUFFER_COUNT, std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+	~SocketProactor();
+
+	/// 内核支持 multishot accept/recv 与 buffer ring (5.19) 时返回 true
+	static bool supported();
+
+	void run();
+
+	void stop();
+
+	void wakeUp();
+
+	/// 可以在任意线程调用: 任务在 Proactor 线程的下一轮循环中执行
+	void post(Task task);
+
+	/// multishot accept, 每个新连接回调一次, 直到出错或 cancel()
+	void accept(const ServerSocket& socket, AcceptHandler handler);
+
+	/// multishot recv, 每次收到数据回调一次, 直到对端关闭、出错或 cancel()
+	void receive(const ServerSocket& socket, ReceiveHandler handler);
+
+	/// 复制数据后排队, 在本轮结束时与同一连接的其它发送链接提交
+	void send(const ServerSocket& socket, const void* buffer, std::size_t length, SendHandler handler = SendHandler());
+
+	/// 取消 socket 上所有未完成的操作, 尚未提交的发送直接丢弃, 之后不再回调这些操作.
+	/// 立即提交, 调用之后可以马上关闭 socket
+	void cancel(const ServerSocket& socket);
+
+	void setTimeout(const std::chrono::system_clock::duration& timeout);
+	const std::chrono::system_clock::duration& getTimeout() const;
+
+	std::size_t bufferCount() const;
+	std::size_t bufferSize() const;
+
+	/// 尚未完成的 accept/recv/send 操作数量
+	std::size_t pendingOperations() const;
+
+	enum
+	{
+		DEFAULT_BUFFER_COUNT = 4096,
+		DEFAULT_BUFFER_SIZE = 4096
+	};
+
+private:
+	enum
+	{
+		DEFAULT_TIMEOUT = 250000,
+		MAX_TASKS_PER_ITERATION = 1024,
+		MAX_LINKED_SENDS = 64,
+		BUFFER_GROUP = 0
+	};
+
+	static constexpr uint64_t WAKEUP_TAG = ~uint64_t(0);
+	static constexpr uint64_t CANCEL_TAG = 0;
+
+	/// 已提交的操作, 地址作为 user_data; multishot 操作在最后一个完成事件之后释放
+	class Operation
+	{
+	public:
+		Operation(int fd, uint32_t generation);
+		virtual ~Operation() = default;
+
+		/// 返回 true 表示操作已经结束
+		virtual bool complete(SocketProactor& proactor, const io_uring_cqe& cqe) = 0;
+
+		int fd;
+		uint32_t generation;
+		Operation* pPrev;
+		Operation* pNext;
+	};
+
+	class AcceptOperation;
+	class ReceiveOperation;
+	class SendOperation;
+
+	/// 每个 fd 的状态. generation 在 cancel() 时递增, 之前提交的操作不再回调;
+	/// 发送链在途时新的发送在 pending 中等待, 整条链完成后再一起提交
+	struct Descriptor
+	{
+		std::vector<SendOperation*> pending;
+		std::size_t inFlight = 0;
+		uint32_t generation = 0;
+		bool dirty = false;
+	};
+
+	io_uring_sqe* getSqe();
+
+	Descriptor& descriptor(int fd);
+
+	bool isCurrent(const Operation& operation) const;
+
+	void link(Operation* pOperation);
+
+	void unlink(Operation* pOperation);
+
+	void submitAccept(AcceptOperation* pOperation);
+
+	void submitReceive(ReceiveOperation* pOperation);
+
+	/// 因 ENOBUFS 终止的接收暂缓重新提交
+	void starve(ReceiveOperation* pOperation);
+
+	void resubmitStarved();
+
+	void markDirty(int fd);
+
+	void flushSends();
+
+	void completeSend(SendOperation* pOperation);
+
+	const char* buffer(unsigned id) const;
+
+	void recycle(unsigned id);
+
+	void armWakeUp();
+
+	void wakeUpIfSleeping();
+
+	void runTasks();
+
+	void wait();
+
+	void processCompletions();
+
+	void createBufferRing();
+
+	void destroyBufferRing();
+
+	std::unique_ptr<IoUring> _pRing;
+	std::atomic<bool> _stop;
+	std::chrono::system_clock::duration _timeout;
+	int _eventfd;
+
+	std::size_t _bufferCount;
+	std::size_t _bufferSize;
+	std::unique_ptr<char[]> _pBuffers;
+	io_uring_buf_ring* _pBufferRing;
+	std::size_t _bufferRingSize;
+	unsigned short _bufferTail;
+
+	Operation* _pOperations;
+	std::size_t _operationCount;
+
+	std::vector<Descriptor> _descriptors;
+	std::vector<int> _dirty;
+	std::vector<ReceiveOperation*> _starved;
+
+	MPSCQueue<Task> _tasks;
+	std::atomic<bool> _sleeping;
+};
+
+//
+// inlines
+//
+inline void SocketProactor::setTimeout(const std::chrono::system_clock::duration& timeout)
+{
+	_timeout = timeout;
+}
+
+inline const std::chrono::system_clock::duration& SocketProactor::getTimeout() const
+{
+	return _timeout;
+}
+
+inline std::size_t SocketProactor::bufferCount() const
+{
+	return _bufferCount;
+}
+
+inline std::size_t SocketProactor::bufferSize() const
+{
+	return _bufferSize;
+}
+
+inline std::size_t SocketProactor::pendingOperations() const
+{
+	return _operationCount;
+}
+
+inline bool SocketProactor::isCurrent(const Operation& operation) const
+{
+	return _descriptors[operation.fd].generation == operation.generation;
+}
+
+inline const char* SocketProactor::buffer(unsigned id) const
+{
+	return _pBuffers.get() + id * _bufferSize;
+}
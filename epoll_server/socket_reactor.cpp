@@ -1,8 +1,26 @@
 #include "socket_reactor.h"
+#include "server_socket.h"
+#include <algorithm>
 #include <memory>
+#include <stdexcept>
+#include <unistd.h>
 
-SocketReactor::SocketReactor()
-	: _stop(false), _pThread(nullptr), _timeout(std::chrono::microseconds(DEFAULT_TIMEOUT))
+SocketReactor::SocketReactor(PollSet::Backend backend)
+	: _stop(false), _edgeTriggered(false), _pThread(nullptr), _timeout(std::chrono::microseconds(DEFAULT_TIMEOUT)),
+	  _pollSet(backend),
+	  _workerThreads(0), _leaderThreads(1), _sleeping(false),
+	  _now(Clock::now()), _woken(_now), _timers(std::chrono::milliseconds(1), _now),
+	  _maxSpin(Clock::duration::zero()), _idleInterval(Clock::duration::zero()),
+	  _spinBudget(0), _spinTime(0), _workTime(0), _spinHits(0), _spinMisses(0),
+	  _socketBusyPoll(0), _preferBusyPoll(false),
+	  _prioritized(false), _dispatchBudget(0),
+	  _pReadableNotification(std::make_shared<ReadableNotification>(this)),
+	  _pWritableNotification(std::make_shared<WritableNotification>(this)),
+	  _pErrorNotification(std::make_shared<ErrorNotification>(this)),
+	  _pReadTimeoutNotification(std::make_shared<ReadTimeoutNotification>(this)),
+	  _pTimeoutNotification(std::make_shared<TimeoutNotification>(this)),
+	  _pIdleNotification(std::make_shared<IdleNotification>(this)),
+	  _pShutdownNotification(std::make_shared<ShutdownNotification>(this))
 {
 }
 
@@ -11,37 +29,73 @@ SocketReactor::~SocketReactor() = default;
 void SocketReactor::run()
 {
 	_pThread = nullptr;
+	// 本线程的 slab 分配和释放不加锁, 工作线程等其它线程仍然加锁
+	_allocator.setOwner(std::this_thread::get_id());
+	if (_leaderThreads > 1)
+	{
+		runLeaderFollowers();
+		_allocator.setOwner(std::thread::id());
+		return;
+	}
+	if (_workerThreads > 0) _pWorkers = std::make_unique<SocketWorkerPool>(*this, _workerThreads);
+
+	PollSet::EventBuffer buffer;
 	while (!_stop)
 	{
 		try
 		{
+			runTasks();
+			applyChanges();
 			if (!hasSocketHandlers())
 			{
 				onIdle();
-				std::this_thread::sleep_for(_timeout);
+				wait(buffer);
+				runTimers();
 			}
 			else
 			{
 				bool readable = false;
-				PollSet::SocketModeMap sm = _pollSet.poll(_timeout);
-				if (sm.size() > 0)
+				PollSet::EventSpan events = wait(buffer);
+				runTimers();
+				if (!events.empty() || !_carried.empty())
 				{
 					onBusy();
-					auto it = sm.begin();
-					auto end = sm.end();
-					for (; it != end; ++it)
+					for (const auto& event : order(events))
 					{
-						if (it->second & PollSet::POLL_READ)
+						auto* pNotifier = static_cast<SocketNotifier*>(event.pData);
+						if (_pWorkers)
 						{
-							dispatch(it->first, _pReadableNotification.get());
+							if (event.mode & PollSet::POLL_READ) readable = true;
+							schedule(pNotifier, event.mode);
+							continue;
+						}
+						if (event.mode & PollSet::POLL_READ)
+						{
+							if (pNotifier->_readTimeout > Clock::duration::zero())
+							{
+								_timers.schedule(pNotifier->_readTimer, _now + pNotifier->_readTimeout);
+							}
+							dispatch(pNotifier, _pReadableNotification.get());
 							readable = true;
 						}
-						if (it->second & PollSet::POLL_WRITE) dispatch(it->first, _pWritableNotification.get());
-						if (it->second & PollSet::POLL_ERROR) dispatch(it->first, _pErrorNotification.get());
+						if (event.mode & PollSet::POLL_WRITE)
+						{
+							// 先发出积压的输出; 可写事件只是 Reactor 自己关注的时候不通知处理器
+							bool blocked = !pNotifier->output().empty();
+							if (drain(pNotifier, blocked) && (!blocked || (pNotifier->interest() & PollSet::POLL_WRITE)))
+							{
+								dispatch(pNotifier, _pWritableNotification.get());
+							}
+						}
+						if (event.mode & PollSet::POLL_ERROR) dispatch(pNotifier, _pErrorNotification.get());
 					}
+					_carrying.clear();
 				}
 				if (!readable) onTimeout();
+				flush();
 			}
+			releaseRetired();
+			_reclaimer.reclaim();
 		}
 		catch (std::exception& exc)
 		{
@@ -50,34 +104,331 @@ void SocketReactor::run()
 		{
 		}
 	}
+	if (_pWorkers)
+	{
+		_pWorkers->stop();
+		_pWorkers.reset();
+	}
 	onShutdown();
+	_reclaimer.reclaim();
+	_allocator.setOwner(std::thread::id());
 }
 
 bool SocketReactor::hasSocketHandlers()
 {
-	if (!_pollSet.empty())
+	return _handlers.activeCount() > 0;
+}
+
+void SocketReactor::stop()
+{
+	_stop = true;
+	wakeUp();
+}
+
+void SocketReactor::wakeUp()
+{
+	_pollSet.wakeUp();
+}
+
+void SocketReactor::post(Task task)
+{
+	_tasks.push(std::move(task));
+	wakeUpIfSleeping();
+}
+
+void SocketReactor::postBatch(std::vector<Task> tasks)
+{
+	if (tasks.empty()) return;
+
+	_tasks.pushBatch(tasks.begin(), tasks.end());
+	wakeUpIfSleeping();
+}
+
+void SocketReactor::postSocket(int sockfd, SocketHandoff handoff, void* pContext)
+{
+	_tasks.push(PostedTask(sockfd, handoff, pContext));
+	wakeUpIfSleeping();
+}
+
+void SocketReactor::wakeUpIfSleeping()
+{
+	// 与 wait() 中先置 _sleeping 再检查队列相对应: 两边都是 seq_cst, 至少有一边能看到对方的写入
+	if (_sleeping.load() && _sleeping.exchange(false)) wakeUp();
+}
+
+void SocketReactor::runTasks()
+{
+	// 限制每轮的数量, 任务中再投递的任务留到下一轮, 不饿死 socket 事件
+	PostedTask task;
+	for (int n = 0; n < MAX_TASKS_PER_ITERATION && _tasks.pop(task); ++n)
 	{
-		std::lock_guard<std::mutex> guard(_mutex);
-		for (auto& p : _handlers)
+		try
 		{
-			if (p.second->accepts(_pReadableNotification.get()) ||
-				p.second->accepts(_pWritableNotification.get()) ||
-				p.second->accepts(_pErrorNotification.get()))
-				return true;
+			task(*this);
 		}
+		catch (std::exception& exc)
+		{
+		}
+		catch (...)
+		{
+		}
+		task = PostedTask();
 	}
+}
 
-	return false;
+SocketReactor::PostedTask::PostedTask(Task task)
+	: _task(std::move(task))
+{
 }
 
-void SocketReactor::stop()
+SocketReactor::PostedTask::PostedTask(int sockfd, SocketHandoff handoff, void* pContext)
+	: _handoff(handoff), _pContext(pContext), _sockfd(sockfd)
 {
-	_stop = true;
 }
 
-void SocketReactor::wakeUp()
+SocketReactor::PostedTask::PostedTask(PostedTask&& other) noexcept
+	: _task(std::move(other._task)), _handoff(other._handoff), _pContext(other._pContext), _sockfd(other._sockfd)
+{
+	other._sockfd = -1;
+}
+
+SocketReactor::PostedTask& SocketReactor::PostedTask::operator=(PostedTask&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		_task = std::move(other._task);
+		_handoff = other._handoff;
+		_pContext = other._pContext;
+		_sockfd = other._sockfd;
+		other._sockfd = -1;
+	}
+	return *this;
+}
+
+SocketReactor::PostedTask::~PostedTask()
+{
+	close();
+}
+
+void SocketReactor::PostedTask::operator()(SocketReactor& reactor)
+{
+	if (!_handoff)
+	{
+		if (_task) _task();
+		return;
+	}
+
+	// 交出 fd 之后不再由本对象关闭, 交接失败时由它自己负责
+	int sockfd = _sockfd;
+	_sockfd = -1;
+	_handoff(_pContext, reactor, sockfd);
+}
+
+void SocketReactor::PostedTask::close()
+{
+	if (_sockfd >= 0) ::close(_sockfd);
+	_sockfd = -1;
+}
+
+PollSet::EventSpan SocketReactor::wait(PollSet::EventBuffer& buffer)
+{
+	// 最多等到下一个定时器到期. 派发、定时器回调和发送都要花时间, 从现在而不是上一次等待返回时算起
+	Clock::time_point start = Clock::now();
+	_now = start;
+	std::chrono::system_clock::duration timeout = _timeout;
+	Clock::duration next = _timers.nextTimeout(_now);
+	if (next < timeout) timeout = std::chrono::duration_cast<std::chrono::system_clock::duration>(next);
+	// 有让出的连接或者任务中排队了输出时只取已经就绪的事件
+	if (!_carried.empty() || !_flushing.empty()) timeout = std::chrono::system_clock::duration::zero();
+
+	// 只有真正需要等待时才统计空闲间隔并尝试空转
+	bool adapt = false;
+	if (_maxSpin > Clock::duration::zero())
+	{
+		// 上一次等待返回到这一次等待开始之间都在处理事件
+		_workTime.fetch_add((start - _woken).count(), std::memory_order_relaxed);
+		adapt = timeout != std::chrono::system_clock::duration::zero() && _tasks.empty();
+		if (adapt)
+		{
+			PollSet::EventSpan events = spin(timeout, buffer);
+			if (!events.empty())
+			{
+				adaptSpin(_now - start);
+				return events;
+			}
+		}
+	}
+
+	if (timeout != std::chrono::system_clock::duration::zero())
+	{
+		_sleeping.store(true);
+		if (!_tasks.empty()) timeout = std::chrono::system_clock::duration::zero();
+	}
+
+	PollSet::EventSpan events = _pollSet.poll(timeout, buffer);
+	_sleeping.store(false, std::memory_order_relaxed);
+	_now = Clock::now();
+	_woken = _now;
+	// 超时也计入: 没有流量时平均间隔变大, 不再空转. 被 post() 唤醒的不算
+	if (adapt && (!events.empty() || _tasks.empty())) adaptSpin(_now - start);
+	return events;
+}
+
+PollSet::EventSpan SocketReactor::spin(std::chrono::system_clock::duration& timeout, PollSet::EventBuffer& buffer)
 {
-//	if (_pThread) _pThread->wakeUp();
+	Clock::duration budget(_spinBudget.load(std::memory_order_relaxed));
+	Clock::duration limit = std::chrono::duration_cast<Clock::duration>(timeout);
+	if (limit < budget) budget = limit;
+	if (budget <= Clock::duration::zero()) return {};
+
+	// 空转期间 _sleeping 为 false, post() 不写 eventfd, 新任务由这里检查队列发现
+	Clock::time_point start = Clock::now();
+	Clock::time_point deadline = start + budget;
+	Clock::time_point now;
+	PollSet::EventSpan events;
+	do
+	{
+		events = _pollSet.poll(std::chrono::system_clock::duration::zero(), buffer);
+		now = Clock::now();
+	} while (events.empty() && _tasks.empty() && !_stop && now < deadline);
+
+	_spinTime.fetch_add((now - start).count(), std::memory_order_relaxed);
+	_now = now;
+	_woken = now;
+	if (!events.empty())
+	{
+		_spinHits.fetch_add(1, std::memory_order_relaxed);
+		return events;
+	}
+
+	_spinMisses.fetch_add(1, std::memory_order_relaxed);
+	timeout -= std::chrono::duration_cast<std::chrono::system_clock::duration>(now - start);
+	if (timeout < std::chrono::system_clock::duration::zero()) timeout = std::chrono::system_clock::duration::zero();
+	return events;
+}
+
+void SocketReactor::adaptSpin(Clock::duration idle)
+{
+	// 空闲间隔的滑动平均 (1/8 权重). 处理事件期间到达的请求不算间隔, 所以不用两次到达之间的时间;
+	// 预计在预算内会有下一批事件时才值得空转, 预算取平均间隔的两倍
+	_idleInterval += (idle - _idleInterval) / 8;
+
+	Clock::duration budget = Clock::duration::zero();
+	if (_idleInterval <= _maxSpin) budget = std::min(_idleInterval * 2, _maxSpin);
+	_spinBudget.store(budget.count(), std::memory_order_relaxed);
+}
+
+void SocketReactor::runTimers()
+{
+	_timers.advance(_now);
+}
+
+void SocketReactor::schedule(Timer& timer, Clock::duration delay, Clock::duration interval)
+{
+	// 每次收到数据都会顺延超时, 不在这里读时钟; 从本轮等待返回时算起, 可能提前本轮已经处理的时间
+	_timers.schedule(timer, _now + delay, interval);
+}
+
+void SocketReactor::refreshNow()
+{
+	_now = Clock::now();
+}
+
+void SocketReactor::setReadTimeout(const ServerSocket& socket, Clock::duration timeout)
+{
+	if (_workerThreads > 0 || _leaderThreads > 1)
+	{
+		throw std::logic_error("read timeouts require dispatching on the reactor thread");
+	}
+
+	NotifierPtr pNotifier = getNotifier(socket);
+	if (!pNotifier) throw std::invalid_argument("socket has no event handlers");
+
+	pNotifier->_readTimeout = timeout;
+	if (timeout <= Clock::duration::zero())
+	{
+		_timers.cancel(pNotifier->_readTimer);
+		return;
+	}
+
+	SocketNotifier* pRaw = pNotifier.get();
+	pNotifier->_readTimer.setCallback([this, pRaw]()
+	{ dispatch(pRaw, _pReadTimeoutNotification.get()); });
+	_timers.schedule(pNotifier->_readTimer, _now + timeout);
+}
+
+void SocketReactor::cancel(Timer& timer)
+{
+	_timers.cancel(timer);
+}
+
+SocketReactor::SleepAwaiter::SleepAwaiter(SocketReactor& reactor, Clock::duration delay)
+	: _reactor(reactor), _delay(delay)
+{
+}
+
+SocketReactor::SleepAwaiter::~SleepAwaiter()
+{
+	unlink();
+}
+
+bool SocketReactor::SleepAwaiter::await_ready()
+{
+	// Reactor 已经停止时定时器不会再触发, 直接以异常返回
+	if (_reactor._stop) _cancelled = true;
+	return _cancelled || _delay <= Clock::duration::zero();
+}
+
+void SocketReactor::SleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	_handle = handle;
+	_timer.setCallback([this]()
+	{
+		unlink();
+		_handle.resume();
+	});
+	link();
+	_reactor.schedule(_timer, _delay);
+}
+
+void SocketReactor::SleepAwaiter::await_resume() const
+{
+	if (_cancelled) throw std::runtime_error("reactor shutdown");
+}
+
+void SocketReactor::SleepAwaiter::link()
+{
+	_pPrev = nullptr;
+	_pNext = _reactor._pSleepers;
+	if (_pNext) _pNext->_pPrev = this;
+	_reactor._pSleepers = this;
+	_linked = true;
+}
+
+void SocketReactor::SleepAwaiter::unlink()
+{
+	if (!_linked) return;
+
+	if (_pPrev) _pPrev->_pNext = _pNext;
+	else _reactor._pSleepers = _pNext;
+	if (_pNext) _pNext->_pPrev = _pPrev;
+	_pPrev = _pNext = nullptr;
+	_linked = false;
+}
+
+SocketReactor::TimerPtr SocketReactor::scheduleAfter(Clock::duration delay, Task task)
+{
+	TimerPtr pTimer = std::make_shared<Timer>(std::move(task));
+	_timers.schedule(pTimer, _now + delay);
+	return pTimer;
+}
+
+SocketReactor::TimerPtr SocketReactor::scheduleEvery(Clock::duration interval, Task task)
+{
+	TimerPtr pTimer = std::make_shared<Timer>(std::move(task));
+	_timers.schedule(pTimer, _now + interval, interval);
+	return pTimer;
 }
 
 void SocketReactor::setTimeout(const std::chrono::system_clock::duration& timeout)
@@ -90,17 +441,92 @@ const std::chrono::system_clock::duration& SocketReactor::getTimeout() const
 	return _timeout;
 }
 
+void SocketReactor::setBusyPoll(Clock::duration maxSpin)
+{
+	_maxSpin = maxSpin;
+	// 开始时按满预算空转, 之后由到达间隔调整
+	_idleInterval = maxSpin / 2;
+	_spinBudget.store(maxSpin.count(), std::memory_order_relaxed);
+}
+
+void SocketReactor::setSocketBusyPoll(int usecs, bool prefer)
+{
+	_socketBusyPoll = usecs;
+	_preferBusyPoll = prefer;
+}
+
+void SocketReactor::prepareSocket(ServerSocket& socket)
+{
+	if (_socketBusyPoll <= 0) return;
+	try
+	{
+		socket.setBusyPoll(_socketBusyPoll, _preferBusyPoll);
+	}
+	catch (...)
+	{
+		// ignore
+	}
+}
+
+SocketReactor::BusyPollStatistics SocketReactor::busyPollStatistics() const
+{
+	BusyPollStatistics stats;
+	stats.spinTime = Clock::duration(_spinTime.load(std::memory_order_relaxed));
+	stats.workTime = Clock::duration(_workTime.load(std::memory_order_relaxed));
+	stats.spinBudget = Clock::duration(_spinBudget.load(std::memory_order_relaxed));
+	stats.spinHits = _spinHits.load(std::memory_order_relaxed);
+	stats.spinMisses = _spinMisses.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void SocketReactor::setEdgeTriggered(bool flag)
+{
+	_edgeTriggered = flag;
+}
+
+bool SocketReactor::isEdgeTriggered() const
+{
+	return _edgeTriggered;
+}
+
+void SocketReactor::setWorkerThreads(std::size_t threads)
+{
+	if (threads > 0 && !ThreadingPolicy::THREAD_SAFE)
+	{
+		throw std::logic_error("worker threads require a thread-safe reactor");
+	}
+	_workerThreads = threads;
+}
+
+std::size_t SocketReactor::getWorkerThreads() const
+{
+	return _workerThreads;
+}
+
+void SocketReactor::setLeaderFollowerThreads(std::size_t threads)
+{
+	if (threads > 1 && !ThreadingPolicy::THREAD_SAFE)
+	{
+		throw std::logic_error("leader/followers threads require a thread-safe reactor");
+	}
+	_leaderThreads = threads;
+}
+
+std::size_t SocketReactor::getLeaderFollowerThreads() const
+{
+	return _leaderThreads;
+}
+
 void SocketReactor::addEventHandler(const ServerSocket& socket, const AbstractObserver& observer)
 {
 	NotifierPtr pNotifier = getNotifier(socket, true);
 
 	if (!pNotifier->hasObserver(observer)) pNotifier->addObserver(this, observer);
 
-	int mode = 0;
-	if (pNotifier->accepts(_pReadableNotification.get())) mode |= PollSet::POLL_READ;
-	if (pNotifier->accepts(_pWritableNotification.get())) mode |= PollSet::POLL_WRITE;
-	if (pNotifier->accepts(_pErrorNotification.get())) mode |= PollSet::POLL_ERROR;
-	if (mode) _pollSet.add(socket, mode);
+	updateMode(socket, pNotifier);
+
+	std::lock_guard<Mutex> guard(_mutex);
+	updateSubscriptions(pNotifier.get());
 }
 
 bool SocketReactor::hasEventHandler(const ServerSocket& socket, const AbstractObserver& observer)
@@ -113,20 +539,97 @@ bool SocketReactor::hasEventHandler(const ServerSocket& socket, const AbstractOb
 
 SocketReactor::NotifierPtr SocketReactor::getNotifier(const ServerSocket& socket, bool makeNew)
 {
-	std::lock_guard<std::mutex> guard(_mutex);
+	std::lock_guard<Mutex> guard(_mutex);
 
-	auto it = _handlers.find(socket);
-	if (it != _handlers.end())
+	NotifierPtr pNotifier = _handlers.find(socket.sockfd());
+	if (!pNotifier && makeNew)
 	{
-		return it->second;
+		pNotifier = std::allocate_shared<SocketNotifier>(SlabStlAllocator<SocketNotifier>(_allocator), socket, _allocator, _reclaimer);
+		_handlers.insert(socket.sockfd(), pNotifier);
 	}
-	else if (makeNew)
+
+	return pNotifier;
+}
+
+int SocketReactor::pollMode(const NotifierPtr& pNotifier)
+{
+	int mode = 0;
+	if (pNotifier->accepts(ReadableNotification::ID)) mode |= PollSet::POLL_READ;
+	if (pNotifier->accepts(WritableNotification::ID)) mode |= PollSet::POLL_WRITE;
+	if (pNotifier->accepts(ErrorNotification::ID)) mode |= PollSet::POLL_ERROR;
+	mode &= pNotifier->interest() | PollSet::POLL_ERROR;
+	// 输出队列积压时由 Reactor 关注可写事件
+	if (!pNotifier->output().empty()) mode |= PollSet::POLL_WRITE;
+	if (mode && _edgeTriggered) mode |= PollSet::POLL_EDGE;
+	if (mode && (_workerThreads > 0 || _leaderThreads > 1)) mode |= PollSet::POLL_ONESHOT;
+	return mode;
+}
+
+void SocketReactor::updateMode(const ServerSocket& socket, const NotifierPtr& pNotifier)
+{
+	std::lock_guard<Mutex> guard(_mutex);
+
+	applyMode(socket, pNotifier);
+}
+
+void SocketReactor::applyMode(const ServerSocket& socket, const NotifierPtr& pNotifier)
+{
+	int mode = pollMode(pNotifier);
+	int current = _handlers.mode(socket.sockfd());
+	_handlers.setMode(socket.sockfd(), mode);
+
+	// 正在工作线程中处理的 socket 由 rearm() 统一重新注册, 避免提前触发而被两个线程同时处理
+	if (pNotifier->isInFlight()) return;
+
+	// 掩码没有变化时不调用 epoll_ctl
+	if (mode == current && (mode == 0 || _pollSet.has(socket))) return;
+
+	if (mode) _pollSet.add(socket, mode, pNotifier.get());
+	else if (_pollSet.has(socket)) _pollSet.update(socket, mode, pNotifier.get());
+}
+
+void SocketReactor::setInterest(const NotifierPtr& pNotifier, int interest)
+{
+	pNotifier->setInterest(interest);
+	requestUpdate(pNotifier);
+}
+
+void SocketReactor::releaseNotifier(const NotifierPtr& pNotifier)
+{
+	if (pNotifier->hasObservers()) return;
+
+	std::lock_guard<Mutex> guard(_mutex);
+	// fd 可能已经关闭并被新连接复用, 只移除仍然是当前这个 notifier 的表项
+	if (!_handlers.isCurrent(pNotifier.get())) return;
+
+	const ServerSocket& socket = pNotifier->socket();
+	_retired.push_back(_handlers.erase(socket.sockfd()));
+	if (_pollSet.has(socket)) _pollSet.remove(socket);
+}
+
+void SocketReactor::requestUpdate(const NotifierPtr& pNotifier)
+{
+	// 处理器不在 Reactor 线程中运行, 变更列表无法由单线程维护, 立即生效
+	if (_workerThreads > 0 || _leaderThreads > 1)
 	{
-		return (_handlers[socket] = std::make_shared<SocketNotifier>(socket));
-//		return (_handlers[socket] = new SocketNotifier(socket));
+		updateMode(pNotifier->socket(), pNotifier);
+		return;
 	}
 
-	return nullptr;
+	if (!pNotifier->setPending(true)) _changes.push_back(pNotifier);
+}
+
+void SocketReactor::applyChanges()
+{
+	if (_changes.empty()) return;
+
+	std::lock_guard<Mutex> guard(_mutex);
+	for (auto& pNotifier : _changes)
+	{
+		pNotifier->setPending(false);
+		if (_handlers.isCurrent(pNotifier.get())) applyMode(pNotifier->socket(), pNotifier);
+	}
+	_changes.clear();
 }
 
 void SocketReactor::removeEventHandler(const ServerSocket& socket, const AbstractObserver& observer)
@@ -137,29 +640,71 @@ void SocketReactor::removeEventHandler(const ServerSocket& socket, const Abstrac
 		if (pNotifier->countObservers() == 1)
 		{
 			{
-				std::lock_guard<std::mutex> guard(_mutex);
-				_handlers.erase(socket);
+				std::lock_guard<Mutex> guard(_mutex);
+				// 本轮事件中可能还持有该 notifier 的指针, 延迟到本轮结束再释放
+				_retired.push_back(_handlers.erase(socket.sockfd()));
 			}
-			_pollSet.remove(socket);
+			if (_pollSet.has(socket)) _pollSet.remove(socket);
 		}
 		pNotifier->removeObserver(this, observer);
 
 		if (pNotifier->countObservers() > 0 && socket.sockfd() > 0)
 		{
-			int mode = 0;
-			if (pNotifier->accepts(_pReadableNotification.get())) mode |= PollSet::POLL_READ;
-			if (pNotifier->accepts(_pWritableNotification.get())) mode |= PollSet::POLL_WRITE;
-			if (pNotifier->accepts(_pErrorNotification.get())) mode |= PollSet::POLL_ERROR;
-			_pollSet.update(socket, mode);
+			updateMode(socket, pNotifier);
 		}
+
+		std::lock_guard<Mutex> guard(_mutex);
+		updateSubscriptions(pNotifier.get());
 	}
 }
 
+void SocketReactor::updateSubscriptions(SocketNotifier* pNotifier)
+{
+	unsigned mask = pNotifier->mask() >> SocketNotification::TIMEOUT;
+	for (int index = 0; index < SocketNotifier::BROADCAST_COUNT; ++index)
+	{
+		bool wanted = mask & (1u << index);
+		bool subscribed = pNotifier->_subscribed & (1u << index);
+		if (wanted && !subscribed) subscribe(pNotifier, index);
+		else if (!wanted && subscribed) unsubscribe(pNotifier, index);
+	}
+}
+
+void SocketReactor::subscribe(SocketNotifier* pNotifier, int index)
+{
+	SubscriberList& list = _subscribers[index];
+	pNotifier->_pPrevSubscriber[index] = nullptr;
+	pNotifier->_pNextSubscriber[index] = list.pHead;
+	if (list.pHead) list.pHead->_pPrevSubscriber[index] = pNotifier;
+	list.pHead = pNotifier;
+	pNotifier->_subscribed |= 1u << index;
+}
+
+void SocketReactor::unsubscribe(SocketNotifier* pNotifier, int index)
+{
+	SubscriberList& list = _subscribers[index];
+	SocketNotifier* pPrev = pNotifier->_pPrevSubscriber[index];
+	SocketNotifier* pNext = pNotifier->_pNextSubscriber[index];
+	if (list.pCursor == pNotifier) list.pCursor = pNext;
+	if (pPrev) pPrev->_pNextSubscriber[index] = pNext;
+	else list.pHead = pNext;
+	if (pNext) pNext->_pPrevSubscriber[index] = pPrev;
+
+	pNotifier->_pPrevSubscriber[index] = nullptr;
+	pNotifier->_pNextSubscriber[index] = nullptr;
+	pNotifier->_subscribed &= ~(1u << index);
+}
+
 bool SocketReactor::has(const ServerSocket& socket) const
 {
 	return _pollSet.has(socket);
 }
 
+std::size_t SocketReactor::countSocketHandlers() const
+{
+	return _handlers.size();
+}
+
 void SocketReactor::onTimeout()
 {
 	dispatch(_pTimeoutNotification.get());
@@ -173,6 +718,16 @@ void SocketReactor::onIdle()
 void SocketReactor::onShutdown()
 {
 	dispatch(_pShutdownNotification.get());
+
+	// 与挂起在读写上的协程一样, 以异常恢复 sleep() 中的协程, 让它们展开并释放帧;
+	// 此时 _stop 已置位, 恢复后再次 sleep() 不会挂起, 循环一定结束
+	while (SleepAwaiter* pSleeper = _pSleepers)
+	{
+		pSleeper->unlink();
+		cancel(pSleeper->_timer);
+		pSleeper->_cancelled = true;
+		pSleeper->_handle.resume();
+	}
 }
 
 void SocketReactor::onBusy()
@@ -183,26 +738,37 @@ void SocketReactor::dispatch(const ServerSocket& socket, SocketNotification* pNo
 {
 	NotifierPtr pNotifier = getNotifier(socket);
 	if (!pNotifier) return;
-	dispatch(pNotifier, pNotification);
+	dispatch(pNotifier.get(), pNotification);
 }
 
 void SocketReactor::dispatch(SocketNotification* pNotification)
 {
-	std::vector<NotifierPtr> delegates;
-	{
-		std::lock_guard<std::mutex> guard(_mutex);
-		delegates.reserve(_handlers.size());
-		for (auto& _handler : _handlers)
-			delegates.push_back(_handler.second);
-	}
-	for (auto& delegate : delegates)
+	int index = pNotification->id() - SocketNotification::TIMEOUT;
+	if (index < 0 || index >= SocketNotifier::BROADCAST_COUNT) return;
+
+	// 被移除的 notifier 留在 _retired 中直到本轮结束, 解锁回调期间裸指针仍然有效
+	SubscriberList& list = _subscribers[index];
+	std::unique_lock<Mutex> lock(_mutex);
+	list.pCursor = list.pHead;
+	while (list.pCursor)
 	{
-		dispatch(delegate, pNotification);
+		SocketNotifier* pNotifier = list.pCursor;
+		list.pCursor = pNotifier->_pNextSubscriber[index];
+
+		// 工作线程正在处理的 socket 不在 Reactor 线程上同时派发
+		if (pNotifier->isInFlight()) continue;
+
+		lock.unlock();
+		dispatch(pNotifier, pNotification);
+		lock.lock();
 	}
 }
 
-void SocketReactor::dispatch(NotifierPtr& pNotifier, SocketNotification* pNotification)
+void SocketReactor::dispatch(SocketNotifier* pNotifier, SocketNotification* pNotification)
 {
+	// 已经被移除 (或 fd 已被复用) 的 notifier 不再派发
+	if (!_handlers.isCurrent(pNotifier)) return;
+
 	try
 	{
 		pNotifier->dispatch(pNotification);
@@ -214,3 +780,257 @@ void SocketReactor::dispatch(NotifierPtr& pNotifier, SocketNotification* pNotifi
 	{
 	}
 }
+
+PollSet::EventSpan SocketReactor::order(PollSet::EventSpan events)
+{
+	if (!_prioritized.load(std::memory_order_relaxed) && _carried.empty()) return events;
+
+	// 优先级只有几级, 每级扫描一遍, 不需要额外的排序缓冲区. 同时有新事件的让出连接合并到新事件中
+	_carrying.swap(_carried);
+	_ready.clear();
+	for (int priority = 0; priority < SocketNotifier::PRIORITY_COUNT; ++priority)
+	{
+		for (const auto& event : events)
+		{
+			auto* pNotifier = static_cast<SocketNotifier*>(event.pData);
+			if (pNotifier->priority() != priority) continue;
+			_ready.push_back({ event.pData, event.mode | pNotifier->takeCarry() });
+		}
+		for (const auto& pNotifier : _carrying)
+		{
+			if (pNotifier->priority() != priority) continue;
+			if (int mode = pNotifier->takeCarry()) _ready.push_back({ pNotifier.get(), mode });
+		}
+	}
+	return _ready;
+}
+
+void SocketReactor::setPriority(const ServerSocket& socket, SocketNotifier::Priority priority)
+{
+	NotifierPtr pNotifier = getNotifier(socket);
+	if (!pNotifier) return;
+
+	pNotifier->setPriority(priority);
+	if (priority != SocketNotifier::PRIORITY_NORMAL) _prioritized = true;
+}
+
+void SocketReactor::setDispatchBudget(std::size_t bytes)
+{
+	_dispatchBudget = bytes;
+}
+
+bool SocketReactor::yield(const ServerSocket& socket, int mode)
+{
+	if (_pWorkers || _leaderThreads > 1) return false;
+
+	NotifierPtr pNotifier = getNotifier(socket);
+	if (!pNotifier) return false;
+
+	if (pNotifier->carry(mode) == 0) _carried.push_back(std::move(pNotifier));
+	return true;
+}
+
+bool SocketReactor::send(const ServerSocket& socket, const void* buffer, std::size_t length)
+{
+	if (_pWorkers || _leaderThreads > 1) return false;
+
+	NotifierPtr pNotifier = getNotifier(socket);
+	if (!pNotifier) return false;
+
+	// 队列不为空时要么已经在本轮的列表中, 要么在等待可写事件
+	OutputQueue& output = pNotifier->output();
+	if (output.empty() && length > 0) _flushing.push_back(pNotifier);
+	output.append(buffer, length);
+	return true;
+}
+
+std::size_t SocketReactor::queued(const ServerSocket& socket)
+{
+	NotifierPtr pNotifier = getNotifier(socket);
+	return pNotifier ? pNotifier->output().size() : 0;
+}
+
+void SocketReactor::flush()
+{
+	for (const auto& pNotifier : _flushing)
+	{
+		drain(pNotifier.get(), false);
+	}
+	_flushing.clear();
+}
+
+bool SocketReactor::drain(SocketNotifier* pNotifier, bool blocked)
+{
+	OutputQueue& output = pNotifier->output();
+	if (output.empty()) return true;
+
+	// 已经注销的连接的 fd 可能已被关闭或复用
+	if (!_handlers.isCurrent(pNotifier))
+	{
+		output.clear();
+		return false;
+	}
+
+	bool full = false;
+	try
+	{
+		full = !output.flush(pNotifier->socket(), _dispatchBudget);
+	}
+	catch (std::exception& exc)
+	{
+		// 连接出错由处理器在读取时发现
+		output.clear();
+	}
+
+	// 积压状态变化时更新 POLL_WRITE
+	bool empty = output.empty();
+	if (empty == blocked) requestUpdate(pNotifier->shared_from_this());
+
+	// 用完本轮的写预算但发送缓冲区还有空间: 与 yield() 一样留到下一轮, 边缘触发时不会再有可写事件
+	if (!empty && !full && pNotifier->carry(PollSet::POLL_WRITE) == 0)
+	{
+		_carried.push_back(pNotifier->shared_from_this());
+	}
+	return empty;
+}
+
+void SocketReactor::releaseRetired()
+{
+	{
+		std::lock_guard<Mutex> guard(_mutex);
+		if (_retired.empty()) return;
+		_releasing.swap(_retired);
+	}
+	_releasing.clear();
+}
+
+void SocketReactor::schedule(SocketNotifier* pNotifier, int mode)
+{
+	if (!_handlers.isCurrent(pNotifier)) return;
+
+	// 已经在工作线程中: 处理完成后的 rearm() 会重新上报仍然就绪的事件
+	if (pNotifier->setInFlight(true)) return;
+
+	_pWorkers->enqueue({ pNotifier->shared_from_this(), mode });
+}
+
+void SocketReactor::process(const NotifierPtr& pNotifier, int mode, DispatchContext& context)
+{
+	if (mode & PollSet::POLL_READ) dispatch(pNotifier.get(), &context.readable);
+	if (mode & PollSet::POLL_WRITE) dispatch(pNotifier.get(), &context.writable);
+	if (mode & PollSet::POLL_ERROR) dispatch(pNotifier.get(), &context.error);
+
+	rearm(pNotifier);
+}
+
+void SocketReactor::rearm(const NotifierPtr& pNotifier)
+{
+	std::lock_guard<Mutex> guard(_mutex);
+
+	pNotifier->setInFlight(false);
+	if (!_handlers.isCurrent(pNotifier.get())) return;
+
+	int mode = _handlers.mode(pNotifier->sockfd());
+	if (mode) _pollSet.update(pNotifier->socket(), mode, pNotifier.get());
+}
+
+void SocketReactor::runLeaderFollowers()
+{
+	std::vector<std::thread> followers;
+	followers.reserve(_leaderThreads - 1);
+	for (std::size_t i = 1; i < _leaderThreads; ++i)
+	{
+		followers.emplace_back([this]()
+		{ leadOrFollow(); });
+	}
+
+	leadOrFollow();
+
+	for (auto& thread : followers)
+	{
+		thread.join();
+	}
+	onShutdown();
+	_reclaimer.reclaim();
+}
+
+void SocketReactor::leadOrFollow()
+{
+	DispatchContext context(this);
+	EpochReclaimer::Record* pRecord = _reclaimer.attach();
+	PollSet::EventBuffer buffer;
+	std::vector<SocketWorkerPool::Task> tasks;
+	std::vector<SocketWorkerPool::Task> ordered;
+	tasks.reserve(buffer.ready.size());
+	ordered.reserve(buffer.ready.size());
+
+	while (!_stop)
+	{
+		try
+		{
+			{
+				// 持有 _leaderMutex 的线程是 leader, 其余线程阻塞在这里等待成为 leader
+				std::lock_guard<Mutex> leader(_leaderMutex);
+				if (_stop) break;
+
+				// 投递的任务只由当前 leader 执行, 满足单消费者的要求
+				runTasks();
+				if (!hasSocketHandlers())
+				{
+					onIdle();
+					wait(buffer);
+					runTimers();
+				}
+				else
+				{
+					bool readable = false;
+					PollSet::EventSpan events = wait(buffer);
+					runTimers();
+					if (!events.empty()) onBusy();
+					for (const auto& event : events)
+					{
+						auto* pNotifier = static_cast<SocketNotifier*>(event.pData);
+						if (event.mode & PollSet::POLL_READ) readable = true;
+						if (!_handlers.isCurrent(pNotifier) || pNotifier->setInFlight(true)) continue;
+						tasks.push_back({ pNotifier->shared_from_this(), event.mode });
+					}
+					if (!readable) onTimeout();
+
+					// 按优先级重排本线程要处理的事件
+					if (_prioritized.load(std::memory_order_relaxed) && tasks.size() > 1)
+					{
+						for (int priority = 0; priority < SocketNotifier::PRIORITY_COUNT; ++priority)
+						{
+							for (auto& task : tasks)
+							{
+								if (task.pNotifier->priority() == priority) ordered.push_back(std::move(task));
+							}
+						}
+						tasks.swap(ordered);
+						ordered.clear();
+					}
+				}
+				// 本线程取到的 notifier 已经持有引用, 可以释放被移除的 notifier
+				releaseRetired();
+				_reclaimer.reclaim();
+			}
+
+			// 交出领导权之后再处理事件, 由下一个 follower 继续等待
+			{
+				EpochReclaimer::Guard guard(_reclaimer, pRecord);
+				for (auto& task : tasks)
+				{
+					process(task.pNotifier, task.mode, context);
+				}
+			}
+			tasks.clear();
+		}
+		catch (std::exception& exc)
+		{
+		}
+		catch (...)
+		{
+		}
+	}
+	_reclaimer.detach(pRecord);
+}
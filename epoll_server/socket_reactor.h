@@ -5,11 +5,21 @@
 #include <mutex>
 #include <thread>
 #include <chrono>
+#include <coroutine>
 #include <ctime>
+#include <functional>
 #include <boost/signals2.hpp>
 
 #include "poll_set.h"
 #include "socket_notifier.h"
+#include "socket_notifier_table.h"
+#include "socket_notification.h"
+#include "socket_worker_pool.h"
+#include "mpsc_queue.h"
+#include "timing_wheel.h"
+#include "socket_registration.h"
+#include "epoch_reclaimer.h"
+#include "slab_allocator.h"
 
 class ServerSocket;
 
@@ -32,12 +42,78 @@ typedef std::shared_ptr<EventHandler> EventHandlerPtr;
 class SocketReactor
 {
 	friend class SocketNotifier;
+	friend class SocketWorkerPool;
+	friend class SocketRegistration;
 	typedef std::shared_ptr<SocketNotifier> NotifierPtr;
 	typedef std::shared_ptr<SocketNotification> NotificationPtr;
-	typedef std::map<ServerSocket, NotifierPtr> EventHandlerMap;
 
 public:
-	SocketReactor();
+	/// 编译期线程模型, 见 threading.h. SingleThreaded 时内部不加锁
+	typedef DefaultThreadingPolicy ThreadingPolicy;
+	typedef ThreadingPolicy::Mutex Mutex;
+
+	typedef std::function<void()> Task;
+	/// 交给 Reactor 的新连接, 在 Reactor 线程中调用, 由它负责 sockfd
+	typedef void (*SocketHandoff)(void* pContext, SocketReactor& reactor, int sockfd);
+	typedef TimingWheel::Clock Clock;
+	typedef std::shared_ptr<Timer> TimerPtr;
+
+	/// 忙轮询的时间分布: spinTime 是空转 poll 的时间, workTime 是两次等待之间处理事件、任务和定时器的时间
+	struct BusyPollStatistics
+	{
+		Clock::duration spinTime;
+		Clock::duration workTime;
+		Clock::duration spinBudget;
+		uint64_t spinHits;   // 空转期间取到了事件
+		uint64_t spinMisses; // 预算用完, 转入阻塞等待
+	};
+
+	/// 每个派发线程独占的一组 socket 通知对象
+	struct DispatchContext
+	{
+		explicit DispatchContext(SocketReactor* pReactor)
+			: readable(pReactor), writable(pReactor), error(pReactor)
+		{
+		}
+
+		ReadableNotification readable;
+		WritableNotification writable;
+		ErrorNotification error;
+	};
+
+	/// co_await reactor.sleep(d) 返回的等待对象, 定时器嵌在协程帧中.
+	/// 挂起期间挂在 Reactor 的链表上, Reactor 关闭时取消定时器并以异常恢复协程
+	class SleepAwaiter : public boost::noncopyable
+	{
+	public:
+		SleepAwaiter(SocketReactor& reactor, Clock::duration delay);
+		~SleepAwaiter();
+
+		bool await_ready();
+
+		void await_suspend(std::coroutine_handle<> handle);
+
+		void await_resume() const;
+
+	private:
+		friend class SocketReactor;
+
+		void link();
+
+		void unlink();
+
+		SocketReactor& _reactor;
+		Clock::duration _delay;
+		Timer _timer;
+		std::coroutine_handle<> _handle;
+		bool _cancelled = false;
+		bool _linked = false;
+		SleepAwaiter* _pPrev = nullptr;
+		SleepAwaiter* _pNext = nullptr;
+	};
+
+	/// backend 为 PollSet::BACKEND_URING 时使用 io_uring, 内核不支持时退回 epoll
+	explicit SocketReactor(PollSet::Backend backend = PollSet::defaultBackend());
 	virtual ~SocketReactor();
 
 public:
@@ -47,15 +123,110 @@ public:
 
 	void wakeUp();
 
+	/// 可以在任意线程调用: 任务在 Reactor 线程的下一轮循环中执行.
+	/// 只有 Reactor 正在 poll 中等待时才写 eventfd 唤醒, 多个线程同时投递只唤醒一次
+	void post(Task task);
+	void postBatch(std::vector<Task> tasks);
+
+	/// 与 post() 共用队列, 但不构造 Task, 投递本身不分配内存. 队列拥有 sockfd 直到交接执行;
+	/// Reactor 销毁时还没有执行的交接直接关闭 sockfd
+	void postSocket(int sockfd, SocketHandoff handoff, void* pContext);
+
+	/// 定时器只能在 Reactor 线程中操作 (其它线程请通过 post()), 到期回调也在 Reactor 线程中执行.
+	/// 连接的空闲/读超时把 Timer 嵌在处理器中, 每次收到数据时重新 schedule, 开销是 O(1)
+	void schedule(Timer& timer, Clock::duration delay, Clock::duration interval = Clock::duration::zero());
+	void cancel(Timer& timer);
+
+	/// 定时器由 Reactor 持有到触发为止, 返回值只用于取消
+	TimerPtr scheduleAfter(Clock::duration delay, Task task);
+	TimerPtr scheduleEvery(Clock::duration interval, Task task);
+
+	/// 缓存的时间, 在每次等待之前和返回之后刷新. schedule() 等从它算起, 派发中设置的定时器
+	/// 可能提前本轮已经花掉的时间; 需要精确时先调用 refreshNow()
+	Clock::time_point now() const;
+
+	void refreshNow();
+
+	/// 读超时: socket 超过 timeout 没有可读事件时, 只向它的处理器派发 ReadTimeoutNotification.
+	/// Reactor 在每次派发可读事件时顺延, 处理器不需要自己的定时器, 开销是 O(1); timeout 为 0 时取消.
+	/// socket 必须已经注册了处理器. 只能在 Reactor 线程中调用, 有工作线程或 leader/followers 线程时抛出 std::logic_error
+	void setReadTimeout(const ServerSocket& socket, Clock::duration timeout);
+
+	/// 协程中 co_await reactor.sleep(d), 在 Reactor 线程中恢复; 与 schedule() 一样只能在 Reactor 线程中使用
+	SleepAwaiter sleep(Clock::duration delay);
+
+	/// 延迟销毁: 单线程时在本轮循环结束时 delete, 有工作线程或 leader/followers 线程时
+	/// 等到所有线程都离开当前的派发之后再 delete. 对象应先注销自己的事件
+	template<class T>
+	void retire(T* pObject);
+
 	void addEventHandler(const ServerSocket& socket, const AbstractObserver& observer);
 	bool hasEventHandler(const ServerSocket& socket, const AbstractObserver& observer);
 	void removeEventHandler(const ServerSocket& socket, const AbstractObserver& observer);
 
 	bool has(const ServerSocket& socket) const;
 
+	std::size_t countSocketHandlers() const;
+
 	void setTimeout(const std::chrono::system_clock::duration& timeout);
 	const std::chrono::system_clock::duration& getTimeout() const;
 
+	/// 边缘触发模式: 只对之后注册的 socket 生效, 处理器需要把 socket 读写到 EAGAIN 为止
+	void setEdgeTriggered(bool flag);
+	bool isEdgeTriggered() const;
+
+	/// 实际使用的多路复用实现
+	PollSet::Backend backend() const;
+
+	/// 同一轮就绪的 socket 按优先级派发, 同级内保持内核返回的顺序. 需在 addEventHandler() 之后调用;
+	/// 全部是 PRIORITY_NORMAL 时不排序. 工作线程模式下决定投递顺序
+	void setPriority(const ServerSocket& socket, SocketNotifier::Priority priority);
+
+	/// 每个连接每轮读写的字节预算, 0 表示不限制. send() 排队的数据每轮最多发出预算的字节数,
+	/// 剩下的留到下一轮, 与让出的连接一起轮转. 读取由处理器进行, Reactor 不截断, 处理器超出后调用 yield()
+	void setDispatchBudget(std::size_t bytes);
+	std::size_t getDispatchBudget() const;
+
+	/// 处理器用完本轮预算但还有数据时调用: mode 留到下一轮, 排在同优先级的新事件之后, 多个连接依次轮转.
+	/// 下一轮不等待新事件. 只在单线程派发时有效, 工作线程或 leader/followers 模式下返回 false, 处理器应继续读写
+	bool yield(const ServerSocket& socket, int mode);
+
+	/// 把数据复制到连接的输出队列, 本轮派发结束后每个连接的队列一次 sendmsg 发出, 流水线请求的多个响应合并成一个报文段.
+	/// 发送缓冲区满时剩下的数据留在队列中, 由 Reactor 关注可写事件, 可写时先发出队列, 处理器打开了写事件时再派发
+	/// WritableNotification. 连接注销时未发出的数据被丢弃. 只在单线程派发时有效, 其它模式下返回 false, 处理器应自己发送
+	bool send(const ServerSocket& socket, const void* buffer, std::size_t length);
+
+	/// 输出队列中尚未发出的字节数, 处理器据此决定是否继续读取
+	std::size_t queued(const ServerSocket& socket);
+
+	/// 忙轮询: 阻塞等待之前先以 0 超时反复 poll, 最多空转 maxSpin. 空转预算按开始等待到事件到达的平均间隔调整,
+	/// 间隔超过 maxSpin 时不再空转, 直接阻塞. zero 关闭, 需在 run() 之前设置
+	void setBusyPoll(Clock::duration maxSpin);
+	Clock::duration getBusyPoll() const;
+
+	/// usecs 大于 0 时, 交给本 Reactor 的新连接设置 SO_BUSY_POLL, prefer 时同时设置 SO_PREFER_BUSY_POLL
+	void setSocketBusyPoll(int usecs, bool prefer = false);
+
+	/// 接受器对每个新连接调用, 应用上面的 socket 选项; 权限不足等错误被忽略
+	void prepareSocket(ServerSocket& socket);
+
+	/// 只在忙轮询模式下统计, 可以在任意线程读取
+	BusyPollStatistics busyPollStatistics() const;
+
+	/// 本 Reactor 的 slab 分配器: 处理器、FIFO 缓冲区和 SocketNotifier 从这里分配.
+	/// 占用情况见 SlabAllocator::statistics()
+	SlabAllocator& allocator();
+
+	/// 大于 0 时就绪的 socket 以 EPOLLONESHOT 注册并交给工作线程处理, 需在注册 socket 之前设置.
+	/// 单线程模型下抛出 std::logic_error, leader/followers 同样
+	void setWorkerThreads(std::size_t threads);
+	std::size_t getWorkerThreads() const;
+
+	/// 大于 1 时 run() 以 leader/followers 方式运行: 多个线程轮流在同一个 PollSet 上等待,
+	/// 取到事件的线程先交出领导权再处理事件. socket 以 EPOLLONESHOT 注册, 需在注册 socket 之前设置
+	void setLeaderFollowerThreads(std::size_t threads);
+	std::size_t getLeaderFollowerThreads() const;
+
 protected:
 	void onTimeout();
 
@@ -66,37 +237,205 @@ protected:
 	void onBusy();
 
 protected:
+	/// 任务队列的元素: 普通任务或者连接交接. 交接在执行之前拥有 fd, 没有执行就被销毁时关闭它
+	class PostedTask
+	{
+	public:
+		PostedTask() = default;
+		PostedTask(Task task);
+		PostedTask(int sockfd, SocketHandoff handoff, void* pContext);
+		PostedTask(PostedTask&& other) noexcept;
+		PostedTask& operator=(PostedTask&& other) noexcept;
+		~PostedTask();
+
+		void operator()(SocketReactor& reactor);
+
+	private:
+		void close();
+
+		Task _task;
+		SocketHandoff _handoff = nullptr;
+		void* _pContext = nullptr;
+		int _sockfd = -1;
+	};
+
 	void dispatch(const ServerSocket& socket, SocketNotification* pNotification);
 
 	void dispatch(SocketNotification* pNotification);
 
-	void dispatch(NotifierPtr& pNotifier, SocketNotification* pNotification);
+	void dispatch(SocketNotifier* pNotifier, SocketNotification* pNotification);
+
+	PollSet::EventSpan order(PollSet::EventSpan events);
+
+	void flush();
+
+	bool drain(SocketNotifier* pNotifier, bool blocked);
 
 	bool hasSocketHandlers();
 
 	NotifierPtr getNotifier(const ServerSocket& socket, bool makeNew = false);
 
+	int pollMode(const NotifierPtr& pNotifier);
+
+	void updateMode(const ServerSocket& socket, const NotifierPtr& pNotifier);
+
+	void applyMode(const ServerSocket& socket, const NotifierPtr& pNotifier);
+
+	void setInterest(const NotifierPtr& pNotifier, int interest);
+
+	/// 没有观察者的 notifier (只由 SocketRegistration 创建) 从 Reactor 中移除
+	void releaseNotifier(const NotifierPtr& pNotifier);
+
+	void requestUpdate(const NotifierPtr& pNotifier);
+
+	void applyChanges();
+
+	void updateSubscriptions(SocketNotifier* pNotifier);
+
+	void subscribe(SocketNotifier* pNotifier, int index);
+
+	void unsubscribe(SocketNotifier* pNotifier, int index);
+
+	void schedule(SocketNotifier* pNotifier, int mode);
+
+	void process(const NotifierPtr& pNotifier, int mode, DispatchContext& context);
+
+	void rearm(const NotifierPtr& pNotifier);
+
+	void runLeaderFollowers();
+
+	void leadOrFollow();
+
+	void releaseRetired();
+
+	void runTasks();
+
+	PollSet::EventSpan wait(PollSet::EventBuffer& buffer);
+
+	PollSet::EventSpan spin(std::chrono::system_clock::duration& timeout, PollSet::EventBuffer& buffer);
+
+	void adaptSpin(Clock::duration idle);
+
+	void wakeUpIfSleeping();
+
+	void runTimers();
+
 private:
 	enum
 	{
-		DEFAULT_TIMEOUT = 250000
+		DEFAULT_TIMEOUT = 250000,
+		MAX_TASKS_PER_ITERATION = 1024
 	};
 
 	std::atomic<bool> _stop;
-	mutable std::mutex _mutex;
+	bool _edgeTriggered;
+	mutable Mutex _mutex;
 	std::thread* _pThread;
 	std::chrono::system_clock::duration _timeout;
 
 	PollSet _pollSet;
 
+	/// 必须先于 _handlers 等持有 slab 内存的成员构造, 后于它们析构
+	SlabAllocator _allocator;
+
+	std::size_t _workerThreads;
+	std::unique_ptr<SocketWorkerPool> _pWorkers;
+
+	std::size_t _leaderThreads;
+	Mutex _leaderMutex;
+
+	MPSCQueue<PostedTask> _tasks;
+	std::atomic<bool> _sleeping;
+
+	Clock::time_point _now;
+	/// 上一次等待返回的时间, 用于统计处理事件的时间
+	Clock::time_point _woken;
+	TimingWheel _timers;
+
+	/// 忙轮询: 空闲间隔的滑动平均只由等待线程更新, 统计用原子变量以便其它线程读取
+	Clock::duration _maxSpin;
+	Clock::duration _idleInterval;
+	std::atomic<Clock::rep> _spinBudget;
+	std::atomic<Clock::rep> _spinTime;
+	std::atomic<Clock::rep> _workTime;
+	std::atomic<uint64_t> _spinHits;
+	std::atomic<uint64_t> _spinMisses;
+	int _socketBusyPoll;
+	bool _preferBusyPoll;
+
+	EpochReclaimer _reclaimer;
+
+	/// 派发顺序: _carried 是本轮让出的连接, 下一轮换到 _carrying 中与新事件一起排进 _ready
+	std::atomic<bool> _prioritized;
+	std::size_t _dispatchBudget;
+	std::vector<NotifierPtr> _carried;
+	std::vector<NotifierPtr> _carrying;
+	std::vector<PollSet::Event> _ready;
+
 private:
-	EventHandlerMap _handlers;
+	SocketNotifierTable _handlers;
+	std::vector<NotifierPtr> _retired;
+	std::vector<NotifierPtr> _releasing;
+	std::vector<NotifierPtr> _changes;
+	std::vector<NotifierPtr> _flushing;
+
+	/// 每种广播通知 (Timeout/Idle/Shutdown) 一条订阅链表, 广播只遍历订阅者.
+	/// 派发时 pCursor 指向下一个节点, 回调中移除该节点时游标随之后移
+	struct SubscriberList
+	{
+		SocketNotifier* pHead = nullptr;
+		SocketNotifier* pCursor = nullptr;
+	};
+	SubscriberList _subscribers[SocketNotifier::BROADCAST_COUNT];
 
 private:
 	NotificationPtr _pReadableNotification;
 	NotificationPtr _pWritableNotification;
 	NotificationPtr _pErrorNotification;
+	NotificationPtr _pReadTimeoutNotification;
 	NotificationPtr _pTimeoutNotification;
 	NotificationPtr _pIdleNotification;
 	NotificationPtr _pShutdownNotification;
+
+	/// 挂起在 sleep() 中的协程, 只在 Reactor 线程中访问
+	SleepAwaiter* _pSleepers = nullptr;
 };
+
+//
+// inlines
+//
+inline SocketReactor::Clock::time_point SocketReactor::now() const
+{
+	return _now;
+}
+
+inline SocketReactor::SleepAwaiter SocketReactor::sleep(Clock::duration delay)
+{
+	return SleepAwaiter(*this, delay);
+}
+
+inline SocketReactor::Clock::duration SocketReactor::getBusyPoll() const
+{
+	return _maxSpin;
+}
+
+inline std::size_t SocketReactor::getDispatchBudget() const
+{
+	return _dispatchBudget;
+}
+
+inline SlabAllocator& SocketReactor::allocator()
+{
+	return _allocator;
+}
+
+inline PollSet::Backend SocketReactor::backend() const
+{
+	return _pollSet.backend();
+}
+
+template<class T>
+inline void SocketReactor::retire(T* pObject)
+{
+	_reclaimer.retire(pObject);
+}
@@ -0,0 +1,222 @@
+
+#include "socket_reactor_pool.h"
+#include "server_socket.h"
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <pthread.h>
+#include <sched.h>
+
+SocketReactorPool::SocketReactorPool(std::size_t threads, Strategy strategy)
+	: _gate(CEvent::EVENT_MANUALRESET), _run(false), _next(0), _strategy(strategy), _affinity(false),
+	  _numaLocal(false), _priority(0)
+{
+	if (threads == 0) threads = 1;
+
+	_reactors.resize(threads);
+}
+
+SocketReactorPool::~SocketReactorPool()
+{
+	try
+	{
+		stop();
+	}
+	catch (...)
+	{
+	}
+}
+
+void SocketReactorPool::start()
+{
+	createReactors();
+	_run = true;
+	_gate.set();
+}
+
+void SocketReactorPool::stop()
+{
+	// 还在等待 start() 的线程直接退出
+	if (!_run) _gate.set();
+	for (auto& pReactor : _reactors)
+	{
+		if (pReactor) pReactor->stop();
+	}
+	for (auto& thread : _threads)
+	{
+		if (thread.joinable()) thread.join();
+	}
+	_threads.clear();
+}
+
+void SocketReactorPool::createReactors()
+{
+	if (_reactors.front()) return;
+
+	// 逐个创建, 前一个线程构造好 Reactor 之后再创建下一个, 失败时不必等待其它线程
+	bool numa = _numaLocal && CpuTopology::instance().nodes().size() > 1;
+	_threads.reserve(_reactors.size());
+	for (std::size_t i = 0; i < _reactors.size(); ++i)
+	{
+		int cpu = threadCpu(i);
+		int node = numa && cpu >= 0 ? CpuTopology::instance().nodeOf(cpu) : -1;
+		_threads.emplace_back(&SocketReactorPool::runThread, this, i, cpu, node);
+		_created.wait();
+
+		if (_pError)
+		{
+			std::exception_ptr pError = _pError;
+			_pError = nullptr;
+			_gate.set();
+			for (auto& thread : _threads)
+			{
+				thread.join();
+			}
+			_threads.clear();
+			_gate.reset();
+			for (auto& pReactor : _reactors)
+			{
+				pReactor.reset();
+			}
+			std::rethrow_exception(pError);
+		}
+	}
+}
+
+void SocketReactorPool::runThread(std::size_t index, int cpu, int node)
+{
+	try
+	{
+		// 内存策略只能由线程自己设置; 先绑定再构造 Reactor, 它的内存才从本地节点分配
+		if (cpu >= 0) pinThread(cpu);
+		if (node >= 0 && !CpuTopology::setPreferredNode(node)) ServerSocket::error();
+		if (_priority > 0) setRealtime();
+		_reactors[index] = std::make_unique<SocketReactor>();
+	}
+	catch (...)
+	{
+		_pError = std::current_exception();
+		_created.set();
+		return;
+	}
+	SocketReactor* pReactor = _reactors[index].get();
+	_created.set();
+
+	_gate.wait();
+	if (_run) pReactor->run();
+}
+
+SocketReactor& SocketReactorPool::next()
+{
+	createReactors();
+	if (_strategy == LEAST_LOADED) return leastLoaded();
+
+	return *_reactors[_next.fetch_add(1, std::memory_order_relaxed) % _reactors.size()];
+}
+
+void SocketReactorPool::setTimeout(const std::chrono::system_clock::duration& timeout)
+{
+	createReactors();
+	for (auto& pReactor : _reactors)
+	{
+		pReactor->setTimeout(timeout);
+	}
+}
+
+void SocketReactorPool::setBusyPoll(SocketReactor::Clock::duration maxSpin)
+{
+	createReactors();
+	for (auto& pReactor : _reactors)
+	{
+		pReactor->setBusyPoll(maxSpin);
+	}
+}
+
+void SocketReactorPool::setSocketBusyPoll(int usecs, bool prefer)
+{
+	createReactors();
+	for (auto& pReactor : _reactors)
+	{
+		pReactor->setSocketBusyPoll(usecs, prefer);
+	}
+}
+
+SocketReactor::BusyPollStatistics SocketReactorPool::busyPollStatistics() const
+{
+	SocketReactor::BusyPollStatistics total{};
+	for (const auto& pReactor : _reactors)
+	{
+		if (!pReactor) continue;
+		SocketReactor::BusyPollStatistics stats = pReactor->busyPollStatistics();
+		total.spinTime += stats.spinTime;
+		total.workTime += stats.workTime;
+		total.spinBudget = std::max(total.spinBudget, stats.spinBudget);
+		total.spinHits += stats.spinHits;
+		total.spinMisses += stats.spinMisses;
+	}
+	return total;
+}
+
+SocketReactor& SocketReactorPool::leastLoaded()
+{
+	// 负载相同时从轮转位置开始, 避免总是选中第一个
+	std::size_t start = _next.fetch_add(1, std::memory_order_relaxed);
+	std::size_t best = start % _reactors.size();
+	std::size_t bestLoad = _reactors[best]->countSocketHandlers();
+	for (std::size_t i = 1; i < _reactors.size() && bestLoad > 0; ++i)
+	{
+		std::size_t index = (start + i) % _reactors.size();
+		std::size_t load = _reactors[index]->countSocketHandlers();
+		if (load < bestLoad)
+		{
+			best = index;
+			bestLoad = load;
+		}
+	}
+	return *_reactors[best];
+}
+
+int SocketReactorPool::threadCpu(std::size_t index) const
+{
+	return _affinity ? selectCpu(index) : -1;
+}
+
+int SocketReactorPool::selectCpu(std::size_t index) const
+{
+	if (!_cpus.empty()) return _cpus[index % _cpus.size()];
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) ServerSocket::error();
+
+	int count = CPU_COUNT(&allowed);
+	if (count == 0) return -1;
+
+	std::size_t nth = index % count;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (!CPU_ISSET(cpu, &allowed)) continue;
+		if (nth-- == 0) return cpu;
+	}
+	return -1;
+}
+
+void SocketReactorPool::pinThread(int cpu)
+{
+	if (cpu >= CPU_SETSIZE) ServerSocket::error(EINVAL);
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc != 0) ServerSocket::error(rc);
+}
+
+void SocketReactorPool::setRealtime()
+{
+	struct sched_param param{};
+	param.sched_priority = _priority;
+	int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (rc != 0) ServerSocket::error(rc);
+}
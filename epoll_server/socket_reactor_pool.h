@@ -0,0 +1,184 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <boost/noncopyable.hpp>
+
+#include "socket_reactor.h"
+#include "event.h"
+
+/// 多 Reactor 多线程: 每个线程运行一个独立的 SocketReactor.
+/// 第一次访问 Reactor 时 (最迟在 start() 中) 创建线程, 每个 Reactor 在自己的线程中绑定 CPU、设置内存策略
+/// 和调度策略之后才构造, 然后等待 start(); 任何一步失败时抛出异常, 已创建的线程全部退出.
+/// 池只跨线程读取原子计数, 并通过 post()/postSocket()/stop() 与各 Reactor 交互, 因此不加锁的 Reactor 也可以组成池;
+/// 这时处理器只能在 start() 之前或在所属 Reactor 的线程中注册
+class SocketReactorPool : public boost::noncopyable
+{
+public:
+	enum Strategy
+	{
+		ROUND_ROBIN,
+		LEAST_LOADED
+	};
+
+	explicit SocketReactorPool(std::size_t threads = std::thread::hardware_concurrency(),
+		Strategy strategy = ROUND_ROBIN);
+	~SocketReactorPool();
+
+	void start();
+
+	void stop();
+
+	std::size_t size() const;
+
+	SocketReactor& reactor(std::size_t index);
+
+	SocketReactor& next();
+
+	void setStrategy(Strategy strategy);
+	Strategy getStrategy() const;
+
+	void setTimeout(const std::chrono::system_clock::duration& timeout);
+
+	/// 见 SocketReactor::setBusyPoll() / setSocketBusyPoll(), 对所有 Reactor 生效, 需在 start() 之前设置
+	void setBusyPoll(SocketReactor::Clock::duration maxSpin);
+	void setSocketBusyPoll(int usecs, bool prefer = false);
+
+	/// 所有 Reactor 的统计之和, spinBudget 取最大值
+	SocketReactor::BusyPollStatistics busyPollStatistics() const;
+
+	/// 把第 i 个线程绑定到 CPU 集合中的第 i 个 CPU 上 (超出时回绕).
+	/// 这里到 setRealtimePriority() 的设置都必须在 Reactor 创建之前进行, 否则抛出 std::logic_error
+	void setThreadAffinity(bool flag);
+	bool getThreadAffinity() const;
+
+	/// 绑定使用的 CPU 集合, 例如 CpuTopology::parseCpuList("0-3,8-11"); 为空时使用进程允许的全部 CPU
+	void setCpus(const std::vector<int>& cpus);
+	const std::vector<int>& getCpus() const;
+
+	/// 第 index 个线程启动时绑定的 CPU, 没有开启绑定或没有可用的 CPU 时返回 -1.
+	/// 结果取决于 setThreadAffinity() 和 setCpus(), 在它们之后调用
+	int threadCpu(std::size_t index) const;
+
+	/// 绑定 CPU 时, 线程的内存 (包括 Reactor 自身) 优先从该 CPU 所在的 NUMA 节点分配, 只有一个节点时不设置.
+	/// 连接的处理器和缓冲区在 Reactor 线程中创建 (ParallelSocketAcceptor 投递到目标 Reactor,
+	/// 分片接受器在本线程 accept), 因此也落在本地节点
+	void setNumaLocal(bool flag);
+	bool getNumaLocal() const;
+
+	/// 大于 0 时线程以 SCHED_FIFO 和该优先级运行, 需要 CAP_SYS_NICE, 失败时创建 Reactor 抛出异常
+	void setRealtimePriority(int priority);
+	int getRealtimePriority() const;
+
+private:
+	void createReactors();
+
+	/// 线程体: 绑定并构造 Reactor, 通知 createReactors(), 等待 start() 或 stop()
+	void runThread(std::size_t index, int cpu, int node);
+
+	void checkPlacement() const;
+
+	SocketReactor& leastLoaded();
+
+	/// 第 index 个线程绑定的 CPU, 没有可用的 CPU 时返回 -1
+	int selectCpu(std::size_t index) const;
+
+	/// 以下两个作用于调用线程
+	void pinThread(int cpu);
+
+	void setRealtime();
+
+	typedef std::unique_ptr<SocketReactor> ReactorPtr;
+
+	/// 创建之前都是空指针
+	std::vector<ReactorPtr> _reactors;
+	std::vector<std::thread> _threads;
+	CEvent _created;
+	CEvent _gate;
+	std::atomic<bool> _run;
+	std::exception_ptr _pError;
+	std::atomic<std::size_t> _next;
+	Strategy _strategy;
+	bool _affinity;
+	std::vector<int> _cpus;
+	bool _numaLocal;
+	int _priority;
+};
+
+//
+// inlines
+//
+inline std::size_t SocketReactorPool::size() const
+{
+	return _reactors.size();
+}
+
+inline SocketReactor& SocketReactorPool::reactor(std::size_t index)
+{
+	createReactors();
+	return *_reactors[index];
+}
+
+inline void SocketReactorPool::setStrategy(Strategy strategy)
+{
+	_strategy = strategy;
+}
+
+inline SocketReactorPool::Strategy SocketReactorPool::getStrategy() const
+{
+	return _strategy;
+}
+
+inline void SocketReactorPool::setThreadAffinity(bool flag)
+{
+	checkPlacement();
+	_affinity = flag;
+}
+
+inline bool SocketReactorPool::getThreadAffinity() const
+{
+	return _affinity;
+}
+
+inline void SocketReactorPool::setCpus(const std::vector<int>& cpus)
+{
+	checkPlacement();
+	_cpus = cpus;
+}
+
+inline const std::vector<int>& SocketReactorPool::getCpus() const
+{
+	return _cpus;
+}
+
+inline void SocketReactorPool::setNumaLocal(bool flag)
+{
+	checkPlacement();
+	_numaLocal = flag;
+}
+
+inline bool SocketReactorPool::getNumaLocal() const
+{
+	return _numaLocal;
+}
+
+inline void SocketReactorPool::setRealtimePriority(int priority)
+{
+	checkPlacement();
+	_priority = priority;
+}
+
+inline int SocketReactorPool::getRealtimePriority() const
+{
+	return _priority;
+}
+
+inline void SocketReactorPool::checkPlacement() const
+{
+	if (_reactors.front()) throw std::logic_error("thread placement must be set before the reactors are created");
+}
@@ -0,0 +1,22 @@
+
+#include "socket_registration.h"
+#include "socket_reactor.h"
+
+SocketRegistration::SocketRegistration(SocketReactor& reactor, const ServerSocket& socket, int mask)
+	: _reactor(reactor), _pNotifier(reactor.getNotifier(socket, true)), _mask(mask)
+{
+	_reactor.setInterest(_pNotifier, _mask);
+}
+
+SocketRegistration::~SocketRegistration()
+{
+	_reactor.releaseNotifier(_pNotifier);
+}
+
+void SocketRegistration::setMask(int mask)
+{
+	if (mask == _mask) return;
+
+	_mask = mask;
+	_reactor.setInterest(_pNotifier, _mask);
+}
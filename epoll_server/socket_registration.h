@@ -0,0 +1,77 @@
+#pragma once
+
+#include <memory>
+#include <boost/noncopyable.hpp>
+
+#include "poll_set.h"
+
+class ServerSocket;
+class SocketReactor;
+class SocketNotifier;
+
+/// 连接的注册句柄: 观察者只注册一次, 之后通过句柄开关读写事件.
+/// 开关只修改缓存的掩码, 掩码变化时把 notifier 放入 Reactor 的变更列表, 由 Reactor 每轮循环统一 epoll_ctl.
+/// 只能在 Reactor 线程中使用; 工作线程/leader-followers 模式下改为立即生效.
+/// 析构时如果 notifier 上没有任何观察者 (例如注册观察者之前构造失败), 把它从 Reactor 中移除.
+class SocketRegistration : public boost::noncopyable
+{
+public:
+	SocketRegistration(SocketReactor& reactor, const ServerSocket& socket, int mask = PollSet::POLL_READ);
+	~SocketRegistration();
+
+	void enableRead();
+	void disableRead();
+
+	void enableWrite();
+	void disableWrite();
+
+	bool isReadEnabled() const;
+	bool isWriteEnabled() const;
+
+	int mask() const;
+
+private:
+	void setMask(int mask);
+
+	SocketReactor& _reactor;
+	std::shared_ptr<SocketNotifier> _pNotifier;
+	int _mask;
+};
+
+//
+// inlines
+//
+inline void SocketRegistration::enableRead()
+{
+	setMask(_mask | PollSet::POLL_READ);
+}
+
+inline void SocketRegistration::disableRead()
+{
+	setMask(_mask & ~PollSet::POLL_READ);
+}
+
+inline void SocketRegistration::enableWrite()
+{
+	setMask(_mask | PollSet::POLL_WRITE);
+}
+
+inline void SocketRegistration::disableWrite()
+{
+	setMask(_mask & ~PollSet::POLL_WRITE);
+}
+
+inline bool SocketRegistration::isReadEnabled() const
+{
+	return _mask & PollSet::POLL_READ;
+}
+
+inline bool SocketRegistration::isWriteEnabled() const
+{
+	return _mask & PollSet::POLL_WRITE;
+}
+
+inline int SocketRegistration::mask() const
+{
+	return _mask;
+}
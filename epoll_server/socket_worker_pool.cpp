@@ -0,0 +1,70 @@
+
+#include "socket_worker_pool.h"
+#include "socket_reactor.h"
+
+SocketWorkerPool::SocketWorkerPool(SocketReactor& reactor, std::size_t threads)
+	: _reactor(reactor), _stop(false)
+{
+	if (threads == 0) threads = 1;
+
+	_threads.reserve(threads);
+	for (std::size_t i = 0; i < threads; ++i)
+	{
+		_threads.emplace_back([this]()
+		{ work(); });
+	}
+}
+
+SocketWorkerPool::~SocketWorkerPool()
+{
+	stop();
+}
+
+void SocketWorkerPool::enqueue(Task&& task)
+{
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		_queue.push_back(std::move(task));
+	}
+	_cond.notify_one();
+}
+
+void SocketWorkerPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		_stop = true;
+	}
+	_cond.notify_all();
+
+	for (auto& thread : _threads)
+	{
+		if (thread.joinable()) thread.join();
+	}
+	_threads.clear();
+}
+
+void SocketWorkerPool::work()
+{
+	// 通知对象在派发时会被写入 socket, 每个工作线程使用自己的一份
+	SocketReactor::DispatchContext context(&_reactor);
+	EpochReclaimer::Record* pRecord = _reactor._reclaimer.attach();
+
+	for (;;)
+	{
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this]()
+			{ return _stop || !_queue.empty(); });
+			if (_queue.empty()) break;
+
+			task = std::move(_queue.front());
+			_queue.pop_front();
+		}
+
+		EpochReclaimer::Guard guard(_reactor._reclaimer, pRecord);
+		_reactor.process(task.pNotifier, task.mode, context);
+	}
+	_reactor._reclaimer.detach(pRecord);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+
+class SocketReactor;
+class SocketNotifier;
+
+/// 单 Reactor 多线程: Reactor 线程只负责等待事件, 就绪的 socket 交给固定数量的工作线程处理.
+/// socket 以 EPOLLONESHOT 注册, 处理完后由工作线程重新注册, 同一个 socket 不会被两个线程同时处理.
+class SocketWorkerPool : public boost::noncopyable
+{
+public:
+	struct Task
+	{
+		std::shared_ptr<SocketNotifier> pNotifier;
+		int mode;
+	};
+
+	SocketWorkerPool(SocketReactor& reactor, std::size_t threads);
+	~SocketWorkerPool();
+
+	void enqueue(Task&& task);
+
+	void stop();
+
+	std::size_t size() const;
+
+private:
+	void work();
+
+	SocketReactor& _reactor;
+
+	std::deque<Task> _queue;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _stop;
+
+	std::vector<std::thread> _threads;
+};
+
+//
+// inlines
+//
+inline std::size_t SocketWorkerPool::size() const
+{
+	return _threads.size();
+}
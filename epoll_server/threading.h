@@ -0,0 +1,49 @@
+#pragma once
+
+#include <mutex>
+
+/// 不做任何事的互斥量, 用于只在一个线程中使用的对象
+class NullMutex
+{
+public:
+	void lock()
+	{
+	}
+
+	bool try_lock()
+	{
+		return true;
+	}
+
+	void unlock()
+	{
+	}
+};
+
+/// 线程模型策略: 作为模板参数决定对象内部使用的锁
+struct MultiThreaded
+{
+	typedef std::mutex Mutex;
+	typedef std::recursive_mutex RecursiveMutex;
+
+	static constexpr bool THREAD_SAFE = true;
+};
+
+struct SingleThreaded
+{
+	typedef NullMutex Mutex;
+	typedef NullMutex RecursiveMutex;
+
+	static constexpr bool THREAD_SAFE = false;
+};
+
+/// SocketReactor 及其内部对象使用的线程模型.
+/// 定义 EPOLL_SERVER_SINGLE_THREADED 时所有锁在编译期去掉, Reactor 只能在自己的线程中使用
+/// (跨线程只能 post()/postSocket()/stop()/wakeUp()), 不支持工作线程和 leader/followers 模式.
+/// 这些用法在运行时抛出 std::logic_error, 而不是在去掉锁之后产生数据竞争.
+/// SocketReactorPool 的每个 Reactor 各自在一个线程中运行, 两种构建都可以使用
+#ifdef EPOLL_SERVER_SINGLE_THREADED
+typedef SingleThreaded DefaultThreadingPolicy;
+#else
+typedef MultiThreaded DefaultThreadingPolicy;
+#endif
@@ -0,0 +1,264 @@
+
+#include "timing_wheel.h"
+
+#include <bit>
+#include <limits>
+#include <exception>
+
+Timer::Timer(Callback callback)
+	: _callback(std::move(callback))
+{
+}
+
+Timer::~Timer()
+{
+	cancel();
+}
+
+void Timer::setCallback(Callback callback)
+{
+	_callback = std::move(callback);
+}
+
+void Timer::cancel()
+{
+	if (_pWheel) _pWheel->cancel(*this);
+}
+
+TimingWheel::TimingWheel(Clock::duration resolution, Clock::time_point origin)
+	: _origin(origin), _resolution(resolution), _now(0), _size(0), _slots{}, _occupied{},
+	  _pOverflow(nullptr), _pDue(nullptr)
+{
+	if (_resolution <= Clock::duration::zero()) _resolution = std::chrono::milliseconds(1);
+}
+
+TimingWheel::~TimingWheel()
+{
+	for (int level = 0; level < LEVELS; ++level)
+	{
+		for (int slot = 0; slot < SLOTS; ++slot)
+		{
+			while (_slots[level][slot]) cancel(*_slots[level][slot]);
+		}
+	}
+	while (_pOverflow) cancel(*_pOverflow);
+	while (_pDue) cancel(*_pDue);
+}
+
+void TimingWheel::schedule(Timer& timer, Clock::time_point deadline, Clock::duration interval)
+{
+	if (timer._pWheel) timer._pWheel->unlink(timer);
+
+	uint64_t expiry = toTick(deadline, true);
+	timer._expiry = expiry > _now ? expiry : _now + 1;
+	timer._interval = 0;
+	if (interval > Clock::duration::zero())
+	{
+		timer._interval = (uint64_t)((interval + _resolution - Clock::duration(1)) / _resolution);
+	}
+	place(timer);
+}
+
+void TimingWheel::schedule(const std::shared_ptr<Timer>& pTimer, Clock::time_point deadline, Clock::duration interval)
+{
+	schedule(*pTimer, deadline, interval);
+	pTimer->_pSelf = pTimer;
+}
+
+void TimingWheel::cancel(Timer& timer)
+{
+	if (timer._pWheel != this) return;
+
+	unlink(timer);
+
+	// 可能是最后一个引用, 释放之后不能再访问 timer
+	std::shared_ptr<Timer> pSelf;
+	pSelf.swap(timer._pSelf);
+}
+
+std::size_t TimingWheel::advance(Clock::time_point now)
+{
+	uint64_t target = toTick(now, false);
+	std::size_t count = 0;
+	while (_now < target)
+	{
+		uint64_t tick = nextTick();
+		if (tick > target)
+		{
+			// 中间没有需要处理的槽, 直接跳到目标 tick, 各层的放置关系仍然成立
+			_now = target;
+			break;
+		}
+
+		_now = tick;
+		collect(tick);
+		count += expire();
+	}
+	return count;
+}
+
+TimingWheel::Clock::duration TimingWheel::nextTimeout(Clock::time_point now) const
+{
+	uint64_t tick = nextTick();
+	if (tick == std::numeric_limits<uint64_t>::max()) return Clock::duration::max();
+
+	Clock::time_point deadline = _origin + _resolution * (Clock::rep)tick;
+	return deadline > now ? deadline - now : Clock::duration::zero();
+}
+
+uint64_t TimingWheel::toTick(Clock::time_point t, bool roundUp) const
+{
+	if (t <= _origin) return 0;
+
+	Clock::duration elapsed = t - _origin;
+	if (roundUp) elapsed += _resolution - Clock::duration(1);
+	return (uint64_t)(elapsed / _resolution);
+}
+
+void TimingWheel::place(Timer& timer)
+{
+	if (timer._expiry <= _now)
+	{
+		link(timer, DUE_LEVEL, 0);
+		return;
+	}
+
+	// 到期 tick 与当前 tick 最高的不同位决定层数, 该层的槽号一定大于当前 tick 在该层的槽号
+	int level = (std::bit_width(timer._expiry ^ _now) - 1) / SLOT_BITS;
+	if (level >= LEVELS)
+	{
+		link(timer, OVERFLOW_LEVEL, 0);
+		return;
+	}
+	link(timer, level, (int)((timer._expiry >> (level * SLOT_BITS)) & (SLOTS - 1)));
+}
+
+void TimingWheel::link(Timer& timer, int level, int slot)
+{
+	Timer*& pHead = head(level, slot);
+	timer._pPrev = nullptr;
+	timer._pNext = pHead;
+	if (pHead) pHead->_pPrev = &timer;
+	pHead = &timer;
+
+	timer._level = level;
+	timer._slot = slot;
+	timer._pWheel = this;
+	if (level < LEVELS) _occupied[level] |= 1ull << slot;
+	++_size;
+}
+
+void TimingWheel::unlink(Timer& timer)
+{
+	Timer*& pHead = head(timer._level, timer._slot);
+	if (timer._pPrev) timer._pPrev->_pNext = timer._pNext;
+	else pHead = timer._pNext;
+	if (timer._pNext) timer._pNext->_pPrev = timer._pPrev;
+
+	if (timer._level < LEVELS && !pHead) _occupied[timer._level] &= ~(1ull << timer._slot);
+
+	timer._pPrev = nullptr;
+	timer._pNext = nullptr;
+	timer._pWheel = nullptr;
+	--_size;
+}
+
+Timer*& TimingWheel::head(int level, int slot)
+{
+	if (level == OVERFLOW_LEVEL) return _pOverflow;
+	if (level == DUE_LEVEL) return _pDue;
+	return _slots[level][slot];
+}
+
+uint64_t TimingWheel::nextTick() const
+{
+	uint64_t next = std::numeric_limits<uint64_t>::max();
+	for (int level = 0; level < LEVELS; ++level)
+	{
+		int shift = level * SLOT_BITS;
+		int current = (int)((_now >> shift) & (SLOTS - 1));
+		if (current == SLOTS - 1) continue;
+
+		uint64_t pending = _occupied[level] & (~0ull << (current + 1));
+		if (!pending) continue;
+
+		// 该层第一个非空槽在 tick 的低位全为 0 时被处理
+		uint64_t base = (_now >> (shift + SLOT_BITS)) << (shift + SLOT_BITS);
+		uint64_t tick = base | ((uint64_t)std::countr_zero(pending) << shift);
+		if (tick < next) next = tick;
+	}
+	if (_pOverflow)
+	{
+		uint64_t tick = ((_now >> RANGE_BITS) + 1) << RANGE_BITS;
+		if (tick < next) next = tick;
+	}
+	return next;
+}
+
+void TimingWheel::collect(uint64_t tick)
+{
+	if ((tick & ((1ull << RANGE_BITS) - 1)) == 0 && _pOverflow) move(OVERFLOW_LEVEL, 0);
+
+	// 先从高层往低层下放, 最后第 0 层当前槽中的定时器全部到期
+	for (int level = LEVELS - 1; level > 0; --level)
+	{
+		int shift = level * SLOT_BITS;
+		if (tick & ((1ull << shift) - 1)) continue;
+		move(level, (int)((tick >> shift) & (SLOTS - 1)));
+	}
+	move(0, (int)(tick & (SLOTS - 1)));
+}
+
+void TimingWheel::move(int level, int slot)
+{
+	Timer*& pHead = head(level, slot);
+	Timer* pTimer = pHead;
+	pHead = nullptr;
+	if (level < LEVELS) _occupied[level] &= ~(1ull << slot);
+
+	while (pTimer)
+	{
+		Timer* pNext = pTimer->_pNext;
+		--_size;
+		place(*pTimer);
+		pTimer = pNext;
+	}
+}
+
+std::size_t TimingWheel::expire()
+{
+	std::size_t count = 0;
+	while (_pDue)
+	{
+		Timer* pTimer = _pDue;
+		unlink(*pTimer);
+
+		// 回调中可能取消, 重新挂入甚至析构这个定时器, 之后不再访问 pTimer
+		Timer::Callback callback = pTimer->_callback;
+		std::shared_ptr<Timer> pSelf;
+		if (pTimer->_interval)
+		{
+			pTimer->_expiry = _now + pTimer->_interval;
+			place(*pTimer);
+			pSelf = pTimer->_pSelf;
+		}
+		else
+		{
+			pSelf.swap(pTimer->_pSelf);
+		}
+
+		++count;
+		if (!callback) continue;
+		try
+		{
+			callback();
+		}
+		catch (std::exception& exc)
+		{
+		}
+		catch (...)
+		{
+		}
+	}
+	return count;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <boost/noncopyable.hpp>
+
+class TimingWheel;
+
+/// 侵入式定时器节点: 嵌在连接等对象中, 挂入/重新挂入/取消都是 O(1), 析构时自动取消
+class Timer : public boost::noncopyable
+{
+public:
+	typedef std::function<void()> Callback;
+
+	Timer() = default;
+	explicit Timer(Callback callback);
+	~Timer();
+
+	void setCallback(Callback callback);
+
+	bool isArmed() const;
+
+	void cancel();
+
+private:
+	friend class TimingWheel;
+
+	Callback _callback;
+	TimingWheel* _pWheel = nullptr;
+	Timer* _pPrev = nullptr;
+	Timer* _pNext = nullptr;
+	uint64_t _expiry = 0;
+	uint64_t _interval = 0;
+	int _level = 0;
+	int _slot = 0;
+	std::shared_ptr<Timer> _pSelf;
+};
+
+/// 分层时间轮: 6 层, 每层 64 个槽, 每层一个占用位图.
+/// 定时器放在到期 tick 与当前 tick 最高不同位所在的层, 高层的槽到点时逐级下放;
+/// 下一个需要处理的 tick 由位图直接算出, 空闲时可以一次跳过任意长的时间.
+/// 不是线程安全的, 只能在所属 Reactor 的线程中使用.
+class TimingWheel : public boost::noncopyable
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	explicit TimingWheel(Clock::duration resolution = std::chrono::milliseconds(1),
+		Clock::time_point origin = Clock::now());
+	~TimingWheel();
+
+	/// 已经挂入的定时器会先被移除; interval 不为 0 时周期触发. 到期时间向上取整到 tick, 不会提前触发
+	void schedule(Timer& timer, Clock::time_point deadline, Clock::duration interval = Clock::duration::zero());
+
+	/// 同上, 在触发 (周期定时器为取消) 之前由时间轮持有一个引用
+	void schedule(const std::shared_ptr<Timer>& pTimer, Clock::time_point deadline,
+		Clock::duration interval = Clock::duration::zero());
+
+	void cancel(Timer& timer);
+
+	/// 触发 now 之前到期的定时器, 返回触发的个数
+	std::size_t advance(Clock::time_point now);
+
+	/// 距离下一个需要处理的 tick 的时间, 没有定时器时返回 Clock::duration::max()
+	Clock::duration nextTimeout(Clock::time_point now) const;
+
+	std::size_t size() const;
+
+	bool empty() const;
+
+	Clock::duration resolution() const;
+
+private:
+	enum
+	{
+		SLOT_BITS = 6,
+		SLOTS = 1 << SLOT_BITS,
+		LEVELS = 6,
+		RANGE_BITS = SLOT_BITS * LEVELS,
+		OVERFLOW_LEVEL = LEVELS,
+		DUE_LEVEL = LEVELS + 1
+	};
+
+	uint64_t toTick(Clock::time_point t, bool roundUp) const;
+
+	void place(Timer& timer);
+
+	void link(Timer& timer, int level, int slot);
+
+	void unlink(Timer& timer);
+
+	Timer*& head(int level, int slot);
+
+	uint64_t nextTick() const;
+
+	void collect(uint64_t tick);
+
+	void move(int level, int slot);
+
+	std::size_t expire();
+
+	Clock::time_point _origin;
+	Clock::duration _resolution;
+	uint64_t _now;
+	std::size_t _size;
+
+	Timer* _slots[LEVELS][SLOTS];
+	uint64_t _occupied[LEVELS];
+	Timer* _pOverflow;
+	Timer* _pDue;
+};
+
+//
+// inlines
+//
+inline bool Timer::isArmed() const
+{
+	return _pWheel != nullptr;
+}
+
+inline std::size_t TimingWheel::size() const
+{
+	return _size;
+}
+
+inline bool TimingWheel::empty() const
+{
+	return _size == 0;
+}
+
+inline TimingWheel::Clock::duration TimingWheel::resolution() const
+{
+	return _resolution;
+}
@@ -0,0 +1,215 @@
+
+#include "uring.h"
+#include "server_socket.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+	int sysSetup(unsigned entries, io_uring_params* pParams)
+	{
+		return (int)::syscall(__NR_io_uring_setup, entries, pParams);
+	}
+
+	int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* pArg, std::size_t argSize)
+	{
+		return (int)::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, pArg, argSize);
+	}
+
+	int sysRegister(int fd, unsigned opcode, void* pArg, unsigned count)
+	{
+		return (int)::syscall(__NR_io_uring_register, fd, opcode, pArg, count);
+	}
+
+	template<class T>
+	T* offset(void* pBase, unsigned off)
+	{
+		return reinterpret_cast<T*>(static_cast<char*>(pBase) + off);
+	}
+}
+
+IoUring::IoUring(unsigned entries)
+	: _ringfd(-1), _features(0),
+	  _pSqRing(MAP_FAILED), _sqRingSize(0), _pCqRing(MAP_FAILED), _cqRingSize(0),
+	  _pSqes(static_cast<io_uring_sqe*>(MAP_FAILED)), _sqesSize(0),
+	  _pSqHead(nullptr), _pSqTail(nullptr), _sqMask(0), _sqEntries(0), _sqeTail(0),
+	  _pCqHead(nullptr), _pCqTail(nullptr), _cqMask(0), _pCqes(nullptr)
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+
+	_ringfd = sysSetup(entries, &params);
+	if (_ringfd < 0) ServerSocket::error();
+	_features = params.features;
+
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (_features & IORING_FEAT_SINGLE_MMAP)
+	{
+		_sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+	}
+
+	_pSqRing = ::mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQ_RING);
+	if (_pSqRing == MAP_FAILED)
+	{
+		int err = ServerSocket::lastError();
+		unmap();
+		ServerSocket::error(err);
+	}
+
+	if (_features & IORING_FEAT_SINGLE_MMAP)
+	{
+		_pCqRing = _pSqRing;
+	}
+	else
+	{
+		_pCqRing = ::mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_CQ_RING);
+	}
+
+	_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	if (_pCqRing != MAP_FAILED)
+	{
+		_pSqes = static_cast<io_uring_sqe*>(::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQES));
+	}
+	if (_pCqRing == MAP_FAILED || _pSqes == MAP_FAILED)
+	{
+		int err = ServerSocket::lastError();
+		unmap();
+		ServerSocket::error(err);
+	}
+
+	_pSqHead = offset<std::atomic<unsigned>>(_pSqRing, params.sq_off.head);
+	_pSqTail = offset<std::atomic<unsigned>>(_pSqRing, params.sq_off.tail);
+	_sqMask = *offset<unsigned>(_pSqRing, params.sq_off.ring_mask);
+	_sqEntries = params.sq_entries;
+	_sqeTail = _pSqTail->load(std::memory_order_relaxed);
+
+	// SQ 数组与 SQE 一一对应, 之后只需推进 tail
+	unsigned* pArray = offset<unsigned>(_pSqRing, params.sq_off.array);
+	for (unsigned i = 0; i < _sqEntries; ++i)
+	{
+		pArray[i] = i;
+	}
+
+	_pCqHead = offset<std::atomic<unsigned>>(_pCqRing, params.cq_off.head);
+	_pCqTail = offset<std::atomic<unsigned>>(_pCqRing, params.cq_off.tail);
+	_cqMask = *offset<unsigned>(_pCqRing, params.cq_off.ring_mask);
+	_pCqes = offset<io_uring_cqe>(_pCqRing, params.cq_off.cqes);
+}
+
+IoUring::~IoUring()
+{
+	unmap();
+}
+
+bool IoUring::supported()
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+
+	// 内核不支持时返回 ENOSYS, 被 sysctl kernel.io_uring_disabled 禁用时返回 EPERM
+	int fd = sysSetup(1, &params);
+	if (fd < 0) return false;
+	::close(fd);
+
+	return (params.features & IORING_FEAT_EXT_ARG) != 0;
+}
+
+io_uring_sqe* IoUring::getSqe()
+{
+	if (_sqeTail - _pSqHead->load(std::memory_order_acquire) >= _sqEntries)
+	{
+		submit();
+		if (_sqeTail - _pSqHead->load(std::memory_order_acquire) >= _sqEntries) return nullptr;
+	}
+
+	io_uring_sqe* pSqe = &_pSqes[_sqeTail & _sqMask];
+	std::memset(pSqe, 0, sizeof(*pSqe));
+	++_sqeTail;
+	return pSqe;
+}
+
+unsigned IoUring::flush()
+{
+	// SQE 的内容必须在 tail 之前对内核可见
+	_pSqTail->store(_sqeTail, std::memory_order_release);
+	return pending();
+}
+
+int IoUring::submit()
+{
+	unsigned toSubmit = flush();
+	if (toSubmit == 0) return 0;
+
+	int rc;
+	do
+	{
+		rc = sysEnter(_ringfd, toSubmit, 0, 0, nullptr, 0);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0 && errno != EAGAIN && errno != EBUSY) ServerSocket::error();
+	return rc < 0 ? 0 : rc;
+}
+
+int IoUring::wait(unsigned toSubmit, unsigned waitNr, std::chrono::system_clock::duration timeout)
+{
+	struct __kernel_timespec ts{};
+	io_uring_getevents_arg arg;
+	std::memset(&arg, 0, sizeof(arg));
+	if (timeout >= std::chrono::system_clock::duration::zero())
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+		ts.tv_sec = ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+
+	// EINTR 由调用方处理, 以便重新计算剩余的超时时间
+	int rc = sysEnter(_ringfd, toSubmit, waitNr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (rc < 0)
+	{
+		if (errno == ETIME) return 0;
+		if (errno == EINTR) return -1;
+		ServerSocket::error();
+	}
+	return rc;
+}
+
+int IoUring::registerBufferRing(io_uring_buf_ring* pRing, unsigned entries, unsigned short groupId)
+{
+	io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(pRing);
+	reg.ring_entries = entries;
+	reg.bgid = groupId;
+
+	return sysRegister(_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 ? -errno : 0;
+}
+
+int IoUring::unregisterBufferRing(unsigned short groupId)
+{
+	io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.bgid = groupId;
+
+	return sysRegister(_ringfd, IORING_UNREGISTER_PBUF_RING, &reg, 1) < 0 ? -errno : 0;
+}
+
+void IoUring::unmap()
+{
+	if (_pSqes != MAP_FAILED) ::munmap(_pSqes, _sqesSize);
+	if (_pCqRing != MAP_FAILED && _pCqRing != _pSqRing) ::munmap(_pCqRing, _cqRingSize);
+	if (_pSqRing != MAP_FAILED) ::munmap(_pSqRing, _sqRingSize);
+	_pSqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	_pCqRing = _pSqRing = MAP_FAILED;
+
+	if (_ringfd >= 0)
+	{
+		::close(_ringfd);
+		_ringfd = -1;
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <boost/noncopyable.hpp>
+#include <linux/io_uring.h>
+
+/// io_uring 的最小封装, 直接使用系统调用, 不依赖 liburing.
+/// 本身不加锁: 准备/提交 SQE 与消费 CQE 各自只能由一个线程进行, 或者由调用方加锁;
+/// wait() 不访问提交队列的用户态状态, 阻塞期间其它线程 (在调用方的锁内) 可以继续提交.
+class IoUring : public boost::noncopyable
+{
+public:
+	explicit IoUring(unsigned entries = DEFAULT_ENTRIES);
+	~IoUring();
+
+	/// 内核支持 io_uring 并且具备本封装依赖的特性 (IORING_FEAT_EXT_ARG, 5.11) 时返回 true
+	static bool supported();
+
+	/// 返回一个清零的 SQE, 提交队列已满时先提交已有的 SQE
+	io_uring_sqe* getSqe();
+
+	/// 已准备但内核尚未消费的 SQE 数量
+	unsigned pending() const;
+
+	/// 不需要提交就能取得的 SQE 数量
+	unsigned space() const;
+
+	/// 把已准备的 SQE 公开给内核, 返回尚未提交的数量
+	unsigned flush();
+
+	/// 提交已准备的 SQE, 不等待完成
+	int submit();
+
+	/// 提交 toSubmit 个已 flush() 的 SQE 并等待至少 waitNr 个完成事件, timeout 为负时无限等待.
+	/// 超时返回 0, 被信号中断返回 -1
+	int wait(unsigned toSubmit, unsigned waitNr, std::chrono::system_clock::duration timeout);
+
+	/// 最早一个未处理的完成事件, 没有时返回 nullptr
+	io_uring_cqe* peekCqe();
+
+	/// 归还 count 个已处理的完成事件
+	void advance(unsigned count = 1);
+
+	/// 注册由内核挑选缓冲区的 buffer ring (IORING_REGISTER_PBUF_RING, 5.19), pRing 必须按页对齐.
+	/// 失败时返回 -errno
+	int registerBufferRing(io_uring_buf_ring* pRing, unsigned entries, unsigned short groupId);
+
+	int unregisterBufferRing(unsigned short groupId);
+
+	int fd() const;
+
+	unsigned features() const;
+
+	enum
+	{
+		DEFAULT_ENTRIES = 4096
+	};
+
+private:
+	void unmap();
+
+	int _ringfd;
+	unsigned _features;
+
+	void* _pSqRing;
+	std::size_t _sqRingSize;
+	void* _pCqRing;
+	std::size_t _cqRingSize;
+	io_uring_sqe* _pSqes;
+	std::size_t _sqesSize;
+
+	std::atomic<unsigned>* _pSqHead;
+	std::atomic<unsigned>* _pSqTail;
+	unsigned _sqMask;
+	unsigned _sqEntries;
+	unsigned _sqeTail;
+
+	std::atomic<unsigned>* _pCqHead;
+	std::atomic<unsigned>* _pCqTail;
+	unsigned _cqMask;
+	io_uring_cqe* _pCqes;
+};
+
+//
+// inlines
+//
+inline unsigned IoUring::pending() const
+{
+	return _sqeTail - _pSqHead->load(std::memory_order_acquire);
+}
+
+inline unsigned IoUring::space() const
+{
+	return _sqEntries - pending();
+}
+
+inline io_uring_cqe* IoUring::peekCqe()
+{
+	unsigned head = _pCqHead->load(std::memory_order_relaxed);
+	if (head == _pCqTail->load(std::memory_order_acquire)) return nullptr;
+	return &_pCqes[head & _cqMask];
+}
+
+inline void IoUring::advance(unsigned count)
+{
+	_pCqHead->store(_pCqHead->load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+inline int IoUring::fd() const
+{
+	return _ringfd;
+}
+
+inline unsigned IoUring::features() const
+{
+	return _features;
+}